@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc_profile.h"
+#include "types.h"
+#include "insts.h"
+#include "jit.h"
+#include "safestd.h"
+
+/* == alloc_profile.c
+ * The allocation profiler counts the objects allocated by each instruction,
+ * which is called the allocation site. Allocations made by primitives and
+ * when calling lambdas are counted at the call instruction.
+ * At exit, the sites and the lambdas containing them are reported in order
+ * of the number of bytes allocated.
+ */
+
+#define PROFILE_TOP 20
+
+enum {
+    KIND_PAIR,
+    KIND_STRING,
+    KIND_VECTOR,
+    KIND_LAMBDA,
+    KIND_ENV,
+    KINDS_NUM,
+};
+
+static const char *kind_names[KINDS_NUM] = {"pairs", "strings", "vectors", "lambdas", "envs"};
+
+typedef struct Alloc_site {
+    uint32_t pc;
+    uint64_t objects[KINDS_NUM];
+    uint64_t bytes;
+} Alloc_site;
+
+static Alloc_site *sites = NULL;
+static uint32_t sites_size = 0;
+
+static int object_kind(Type type) {
+    switch (type) {
+    case TYPE_PAIR:
+        return KIND_PAIR;
+    case TYPE_STRING:
+        return KIND_STRING;
+    case TYPE_VECTOR:
+        return KIND_VECTOR;
+    case TYPE_LAMBDA:
+        return KIND_LAMBDA;
+    default:
+        return KIND_ENV;
+    }
+}
+
+void record_alloc(Type type, size_t size) {
+    uint32_t pc = jit_source_pc(alloc_pc);
+    if (pc >= sites_size) {
+        uint32_t new_size = sites_size ? sites_size : 4096;
+        while (new_size <= pc)
+            new_size *= 2;
+        sites = s_realloc(sites, new_size * sizeof(Alloc_site));
+        memset(sites + sites_size, 0, (new_size - sites_size) * sizeof(Alloc_site));
+        sites_size = new_size;
+    }
+    sites[pc].objects[object_kind(type)]++;
+    sites[pc].bytes += size;
+}
+
+static uint64_t total_objects(Alloc_site *site) {
+    uint64_t objects = 0;
+    for (int i = 0; i < KINDS_NUM; i++)
+        objects += site->objects[i];
+    return objects;
+}
+
+static int compare_sites(const void *a, const void *b) {
+    uint64_t x = ((const Alloc_site *)a)->bytes, y = ((const Alloc_site *)b)->bytes;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void print_site(Alloc_site *site) {
+    eprintf("  %12"PRIu64" %10"PRIu64"  ", site->bytes, total_objects(site));
+    const char *separator = "";
+    for (int i = 0; i < KINDS_NUM; i++) {
+        if (site->objects[i] != 0) {
+            eprintf("%s%"PRIu64" %s", separator, site->objects[i], kind_names[i]);
+            separator = ", ";
+        }
+    }
+}
+
+void print_alloc_profile(void) {
+    fflush(stdout);
+    uint32_t end = this_inst();
+    uint32_t *lambdas = find_lambdas();
+    Alloc_site *by_site = s_malloc((sites_size + 1) * sizeof(Alloc_site));
+    Alloc_site *by_lambda = s_malloc((end + 1) * sizeof(Alloc_site));
+    memset(by_lambda, 0, (end + 1) * sizeof(Alloc_site));
+    Alloc_site total = {0};
+    uint32_t sites_num = 0;
+    for (uint32_t pc = 0; pc < sites_size; pc++) {
+        if (sites[pc].bytes == 0)
+            continue;
+        by_site[sites_num] = sites[pc];
+        by_site[sites_num++].pc = pc;
+        // top-level code is counted in the last entry
+        uint32_t lambda = pc < end && lambdas[pc] != UINT32_MAX ? lambdas[pc] : end;
+        by_lambda[lambda].pc = lambda == end ? UINT32_MAX : lambda;
+        by_lambda[lambda].bytes += sites[pc].bytes;
+        total.bytes += sites[pc].bytes;
+        for (int i = 0; i < KINDS_NUM; i++) {
+            by_lambda[lambda].objects[i] += sites[pc].objects[i];
+            total.objects[i] += sites[pc].objects[i];
+        }
+    }
+    qsort(by_site, sites_num, sizeof(Alloc_site), compare_sites);
+    qsort(by_lambda, end + 1, sizeof(Alloc_site), compare_sites);
+
+    eprintf("Allocation profile:\n");
+    print_site(&total);
+    eprintf("\nSites:\n  %12s %10s\n", "bytes", "objects");
+    for (uint32_t i = 0; i < sites_num && i < PROFILE_TOP; i++) {
+        print_site(&by_site[i]);
+        eprintf(" at %"PRIu32" in ", by_site[i].pc);
+        print_lambda(stderr, by_site[i].pc < end ? lambdas[by_site[i].pc] : UINT32_MAX);
+        eprintf("\n");
+    }
+    eprintf("Lambdas:\n  %12s %10s\n", "bytes", "objects");
+    for (uint32_t i = 0; i <= end && i < PROFILE_TOP && by_lambda[i].bytes != 0; i++) {
+        print_site(&by_lambda[i]);
+        eprintf(" in ");
+        print_lambda(stderr, by_lambda[i].pc);
+        eprintf("\n");
+    }
+    free(lambdas);
+    free(by_site);
+    free(by_lambda);
+}
@@ -0,0 +1,13 @@
+#include <stddef.h>
+
+#include "types.h"
+
+/* == alloc_profile.h
+ * The allocation profiler is only compiled in if ALLOC_PROFILE is defined.
+ * `alloc_pc` is set by exec() to the instruction being executed before
+ * every instruction which may allocate memory.
+ */
+
+uint32_t alloc_pc;
+void record_alloc(Type type, size_t size);
+void print_alloc_profile(void);
@@ -0,0 +1,123 @@
+#include "types.h"
+#include "alloc_profile.h"
+#include "emit_c.h"
+#include "exec_gc.h"
+#include "insts.h"
+#include "jit.h"
+#include "memory.h"
+#include "primitives.h"
+#include "profile.h"
+#include "primitives/number.h"
+
+/* == aot.h
+ * Included by the C files written by --emit-c (see emit_c.c), which are
+ * compiled together with the interpreter with AOT defined.
+ * Such a file contains the program as bytecode, which is loaded at
+ * `aot_start` before aot_register() installs the functions translated
+ * from its lambdas. They run the body of a lambda the same way as
+ * the machine code of the JIT compiler, see jit.c, keeping the stack
+ * pointer in the local `sp`. The macros below translate the instructions,
+ * given by their position relative to `aot_start`.
+ */
+
+#ifdef ALLOC_PROFILE
+#define AOT_ALLOC_PC(n) (alloc_pc = AOT_PC(n))
+#else
+#define AOT_ALLOC_PC(n)
+#endif
+
+#define AOT_PC(n) (aot_start + (n))
+#define AOT_PUSH(val) (*sp++ = (val))
+
+/* -- AOT_EXIT
+ * Returns to the interpreter, which continues at instruction `n`.
+ */
+#define AOT_EXIT(n) do { \
+        stack_ptr = sp; \
+        return AOT_PC(n); \
+    } while (0)
+
+/* -- AOT_CHECK_STACK
+ * Exits at `n` if pushing `size` values could overflow the stack.
+ */
+#define AOT_CHECK_STACK(n, size) do { \
+        if (sp + (size) > stack + STACK_SIZE) \
+            AOT_EXIT(n); \
+    } while (0)
+
+#define AOT_CONST(n) AOT_PUSH(consts[insts[AOT_PC(n)].index])
+
+#define AOT_FRAME(frame) \
+    Env *env_ = exec_env; \
+    for (uint32_t i_ = 0; i_ < (frame); i_++) \
+        env_ = env_->outer
+
+#define AOT_VAR(n, frame, index) do { \
+        AOT_FRAME(frame); \
+        if (env_->vals[index].type == TYPE_UNDEF) \
+            AOT_EXIT(n); \
+        AOT_PUSH(env_->vals[index]); \
+    } while (0)
+
+/* -- AOT_GLOBAL
+ * Pushes a global variable, exiting if the interpreter hasn't located it yet.
+ */
+#define AOT_GLOBAL(n) do { \
+        Inst inst_ = insts[AOT_PC(n)]; \
+        if (inst_.type == INST_NAME || global_env->bindings[inst_.var.index].val.type == TYPE_UNDEF) \
+            AOT_EXIT(n); \
+        AOT_PUSH(global_env->bindings[inst_.var.index].val); \
+    } while (0)
+
+#define AOT_JUMP_FALSE(label) do { \
+        sp--; \
+        if (sp->type == TYPE_BOOL && sp->int_data == 0) \
+            goto label; \
+    } while (0)
+
+/* -- AOT_ARITH
+ * Exits unless the global at `binding` is still `prim` and both arguments
+ * are fixnums, and otherwise replaces them with `result`.
+ */
+#define AOT_ARITH(n, binding, prim, result) do { \
+        Val op_ = global_env->bindings[binding].val; \
+        if (op_.type != TYPE_PRIM || op_.prim_data != prim \
+                || sp[-2].type != TYPE_INT || sp[-1].type != TYPE_INT) \
+            AOT_EXIT(n); \
+        sp[-2] = result; \
+        sp--; \
+    } while (0)
+
+#define AOT_ADD(n) AOT_ARITH(n, add_binding, add_prim, \
+        ((Val){TYPE_INT, {.int_data = sp[-2].int_data + sp[-1].int_data}}))
+#define AOT_SUB(n) AOT_ARITH(n, sub_binding, sub_prim, \
+        ((Val){TYPE_INT, {.int_data = sp[-2].int_data - sp[-1].int_data}}))
+#define AOT_LT(n) AOT_ARITH(n, lt_binding, lt_prim, \
+        ((Val){TYPE_BOOL, {.int_data = sp[-2].int_data < sp[-1].int_data}}))
+#define AOT_NUM_EQ(n) AOT_ARITH(n, num_eq_binding, equ_prim, \
+        ((Val){TYPE_BOOL, {.int_data = sp[-2].int_data == sp[-1].int_data}}))
+
+/* -- AOT_CALL
+ * Calls a primitive directly. Otherwise, or if a profiling sample is due,
+ * exits to `call`, which is the trampoline of the call if it has one.
+ */
+#define AOT_CALL(n, num, call) do { \
+        Val *op_ = sp - (num) - 1; \
+        stack_ptr = sp; \
+        if (op_->type != TYPE_PRIM || profile_pending) \
+            return (call); \
+        AOT_ALLOC_PC(n); \
+        *op_ = op_->prim_data(op_ + 1, num); \
+        sp = op_ + 1; \
+    } while (0)
+
+#define AOT_TAIL_CALL(n, num) do { \
+        Val *op_ = sp - (num) - 1; \
+        stack_ptr = sp; \
+        if (op_->type != TYPE_PRIM || profile_pending) \
+            return AOT_PC(n); \
+        AOT_ALLOC_PC(n); \
+        *op_ = op_->prim_data(op_ + 1, num); \
+        stack_ptr = op_ + 1; \
+        return return_inst; \
+    } while (0)
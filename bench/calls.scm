@@ -0,0 +1,16 @@
+;;; Call-heavy benchmark: doubly recursive Fibonacci and Ackermann functions.
+
+(define (fib n)
+  (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+
+(define (ack m n)
+  (cond ((= m 0) (+ n 1))
+        ((= n 0) (ack (- m 1) 1))
+        (else (ack (- m 1) (ack m (- n 1))))))
+
+(display (fib 30))
+(newline)
+(display (ack 3 7))
+(newline)
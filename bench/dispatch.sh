@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# Compares the threaded and switch-based dispatch in exec() on a call-heavy
+# and a loop-heavy program. Requires `unicode/update.sh` to have been run.
+# The binaries are built next to compiler.sss, since they load it from
+# their own directory.
+
+set -e
+
+cd "$(dirname "$0")/.."
+trap 'rm -f _bench_threaded _bench_switch' EXIT
+
+sources=(*.c primitives/*.c unicode/unicode.c)
+"${CC:-clang}" -O3 "${sources[@]}" -o _bench_threaded "${@:1}"
+"${CC:-clang}" -O3 -DSWITCH_DISPATCH "${sources[@]}" -o _bench_switch "${@:1}"
+
+for program in bench/calls.scm bench/loop.scm; do
+    for variant in threaded switch; do
+        TIMEFORMAT="$program ($variant): %R s"
+        time "./_bench_$variant" "$program" --run --no-cache > /dev/null
+    done
+done
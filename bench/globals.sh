@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# Times loading a program with many top-level definitions (50000 by default),
+# each of which refers to the previous one. Uses the `scheme` binary built
+# by compile.sh.
+
+set -e
+
+cd "$(dirname "$0")/.."
+file="$(mktemp)"
+trap 'rm -f "$file"' EXIT
+
+n="${1:-50000}"
+awk -v n="$n" 'BEGIN {
+    print "(define def-0 0)"
+    for (i = 1; i < n; i++)
+        printf "(define def-%d (+ def-%d 1))\n", i, i - 1
+    printf "(display def-%d)\n(newline)\n", n - 1
+}' > "$file"
+
+TIMEFORMAT="$n definitions: %R s"
+time ./scheme "$file" --run --no-cache
@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# Compares the interpreter with and without the JIT compiler on a call-heavy
+# and a loop-heavy program. Requires `unicode/update.sh` to have been run.
+# The binaries are built next to compiler.sss, since they load it from
+# their own directory.
+
+set -e
+
+cd "$(dirname "$0")/.."
+trap 'rm -f _bench_jit _bench_interpreter' EXIT
+
+sources=(*.c primitives/*.c unicode/unicode.c)
+"${CC:-clang}" -O3 "${sources[@]}" -o _bench_jit "${@:1}"
+"${CC:-clang}" -O3 -DNO_JIT "${sources[@]}" -o _bench_interpreter "${@:1}"
+
+for program in bench/calls.scm bench/loop.scm; do
+    for variant in jit interpreter; do
+        TIMEFORMAT="$program ($variant): %R s"
+        time "./_bench_$variant" "$program" --run --no-cache > /dev/null
+    done
+done
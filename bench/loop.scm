@@ -0,0 +1,23 @@
+;;; Loop-heavy benchmark: tail-recursive loops over integers and a vector.
+
+(define (count-up i n acc)
+  (if (< i n)
+      (count-up (+ i 1) n (+ acc i))
+      acc))
+
+(define v (make-vector 1000 1))
+
+(define (vector-sum i acc)
+  (if (= i (vector-length v))
+      acc
+      (vector-sum (+ i 1) (+ acc (vector-ref v i)))))
+
+(define (repeat k acc)
+  (if (= k 0)
+      acc
+      (repeat (- k 1) (+ acc (vector-sum 0 0)))))
+
+(display (count-up 0 3000000 0))
+(newline)
+(display (repeat 2000 0))
+(newline)
@@ -0,0 +1,280 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "insts.h"
+#include "parser.h"
+#include "safestd.h"
+#include "types.h"
+
+/* == cache.c
+ * An entry of the cache is a bytecode file named after a hash of the contents
+ * of the source file, of compiler.sss, and of the state of the compiler the
+ * file is compiled in, in the directory `scheme` in $XDG_CACHE_HOME, or in
+ * ~/.cache if it isn't set. Since the macros defined by the image the
+ * interpreter was started from and by the files loaded before change how
+ * a file is compiled, its hash includes them as well. A file without an entry
+ * is compiled whole before it is run, like by --compile, and the entry
+ * is written afterwards.
+ *
+ * Only the last of the input files is cached. The macros a file defines only
+ * exist once it has been compiled, so loading the bytecode of an earlier file
+ * would leave them undefined for the files following it.
+ *
+ * Entries are written to a temporary file which is then renamed, so that
+ * other processes never read a partially written one. The bytecode of an entry
+ * is followed by its size and hash, as 8-byte big-endian numbers. An entry
+ * which doesn't match them, such as one cut short by a full disk, is deleted
+ * and the file compiled again. Writers are serialized
+ * by an exclusive lock on the file `lock` in the directory, and don't replace
+ * an entry another process has written in the meantime. The cache is only
+ * used if all of this succeeds, and is skipped otherwise.
+ */
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static uint64_t hash_bytes(uint64_t hash, const unsigned char *data, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    return hash;
+}
+
+/* -- get_compiler_hash
+ * Returns the hash of compiler.sss, reading it the first time.
+ */
+uint64_t get_compiler_hash(void) {
+    if (compiler_hash != 0)
+        return compiler_hash;
+    FILE *f = open_compiler();
+    unsigned char buf[4096];
+    size_t n;
+    uint64_t hash = FNV_OFFSET;
+    while ((n = fread(buf, 1, sizeof(buf), f)) != 0)
+        hash = hash_bytes(hash, buf, n);
+    fclose(f);
+    compiler_hash = hash != 0 ? hash : 1;
+    return compiler_hash;
+}
+
+/* -- context_hash
+ * A hash of the image and the files loaded so far, which determine the state
+ * of the compiler the next file is compiled in.
+ */
+static uint64_t context_hash = FNV_OFFSET;
+
+/* -- read_all
+ * Reads the rest of `f`. Returns NULL if it can't be read.
+ */
+static unsigned char *read_all(FILE *f, size_t *size) {
+    size_t capacity = 4096;
+    unsigned char *data = s_malloc(capacity);
+    *size = 0;
+    while (1) {
+        *size += fread(data + *size, 1, capacity - *size, f);
+        if (*size < capacity)
+            break;
+        capacity *= 2;
+        data = s_realloc(data, capacity);
+    }
+    if (ferror(f)) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+static unsigned char *read_file(const char *file_name, size_t *size) {
+    FILE *f = s_fopen(file_name, "rb");
+    unsigned char *data = read_all(f, size);
+    if (data == NULL) {
+        eprintf("Error: could not read file\n");
+        exit(1);
+    }
+    fclose(f);
+    return data;
+}
+
+#define ENTRY_TRAILER_SIZE 16
+
+static void put_uint64(unsigned char *p, uint64_t n) {
+    for (int i = 7; i >= 0; i--, n >>= 8)
+        p[i] = (unsigned char)n;
+}
+
+static uint64_t get_uint64(const unsigned char *p) {
+    uint64_t n = 0;
+    for (int i = 0; i < 8; i++)
+        n = n << 8 | p[i];
+    return n;
+}
+
+/* -- load_entry
+ * Loads the entry at `path`. Returns 0 if it can't be read or is invalid.
+ */
+static int load_entry(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return 0;
+    size_t size;
+    unsigned char *data = read_all(f, &size);
+    fclose(f);
+    if (data == NULL)
+        return 0;
+    size_t len = size - ENTRY_TRAILER_SIZE;
+    int valid = size >= ENTRY_TRAILER_SIZE && get_uint64(data + len) == len
+        && get_uint64(data + len + 8) == hash_bytes(FNV_OFFSET, data, len) && is_bytecode(data, len);
+    if (valid)
+        load_bytecode(data, len, 1);
+    free(data);
+    return valid;
+}
+
+/* -- cache_dir
+ * Returns the directory of the cache, creating it if needed,
+ * or NULL if there is none.
+ */
+static char *cache_dir(void) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    char *dir;
+    if (base != NULL && base[0] != '\0') {
+        dir = s_malloc(strlen(base) + sizeof("/scheme"));
+        sprintf(dir, "%s", base);
+    } else {
+        const char *home = getenv("HOME");
+        if (home == NULL || home[0] == '\0')
+            return NULL;
+        dir = s_malloc(strlen(home) + sizeof("/.cache/scheme"));
+        sprintf(dir, "%s/.cache", home);
+    }
+    mkdir(dir, 0777);
+    strcat(dir, "/scheme");
+    struct stat st;
+    if (mkdir(dir, 0777) != 0 && (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))) {
+        free(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+static int write_all(int fd, const char *data, size_t size) {
+    while (size != 0) {
+        ssize_t n = write(fd, data, size);
+        if (n <= 0)
+            return 0;
+        data += n;
+        size -= (size_t)n;
+    }
+    return 1;
+}
+
+/* -- save_entry
+ * Writes the instructions from `start` to `end` as the entry at `path`
+ * in `dir`, unless another process already has. Nothing is written if
+ * they contain a constant which can't be saved as bytecode, such as a vector.
+ */
+static void save_entry(const char *dir, const char *path, uint32_t start, uint32_t end) {
+    char *data;
+    size_t size;
+    FILE *mem = open_memstream(&data, &size);
+    if (mem == NULL)
+        return;
+    Val invalid;
+    int saved = try_save_insts(mem, start, end, &invalid);
+    fclose(mem);
+    if (!saved) {
+        free(data);
+        return;
+    }
+    unsigned char trailer[ENTRY_TRAILER_SIZE];
+    put_uint64(trailer, size);
+    put_uint64(trailer + 8, hash_bytes(FNV_OFFSET, (const unsigned char *)data, size));
+
+    char *lock_path = s_malloc(strlen(dir) + sizeof("/lock"));
+    sprintf(lock_path, "%s/lock", dir);
+    int lock = open(lock_path, O_RDWR | O_CREAT, 0666);
+    if (lock >= 0 && flock(lock, LOCK_EX) == 0 && access(path, F_OK) != 0) {
+        char *temp_path = s_malloc(strlen(path) + sizeof(".XXXXXX"));
+        sprintf(temp_path, "%s.XXXXXX", path);
+        int fd = mkstemp(temp_path);
+        if (fd >= 0) {
+            int written = write_all(fd, data, size) && write_all(fd, (const char *)trailer, sizeof(trailer));
+            if (close(fd) != 0 || !written || rename(temp_path, path) != 0)
+                unlink(temp_path);
+        }
+        free(temp_path);
+    }
+    // closing the file releases the lock
+    if (lock >= 0)
+        close(lock);
+    free(lock_path);
+    free(data);
+}
+
+/* -- cache_add_image
+ * Adds the image the interpreter was started from to the hashes of the files
+ * loaded afterwards.
+ */
+void cache_add_image(const char *file_name) {
+    size_t size;
+    unsigned char *data = read_file(file_name, &size);
+    context_hash = hash_bytes(context_hash, data, size);
+    free(data);
+}
+
+/* -- load_cached
+ * Loads a Scheme file like a bytecode file. If `cached` is set, it is loaded
+ * from its entry in the cache if it has one, and otherwise compiled and added
+ * as an entry. Otherwise, it is only compiled.
+ */
+void load_cached(const char *file_name, int cached) {
+    size_t size;
+    unsigned char *source = read_file(file_name, &size);
+    uint64_t compiler = get_compiler_hash();
+    uint64_t hash = hash_bytes(FNV_OFFSET, (const unsigned char *)&compiler, sizeof(compiler));
+    hash = hash_bytes(hash, (const unsigned char *)&context_hash, sizeof(context_hash));
+    hash = hash_bytes(hash, source, size);
+    // the hash already covers everything loaded before the file
+    context_hash = hash;
+
+    char *dir = cached ? cache_dir() : NULL;
+    char *path = NULL;
+    if (dir != NULL) {
+        path = s_malloc(strlen(dir) + sizeof("/0123456789abcdef.sss"));
+        sprintf(path, "%s/%016llx.sss", dir, (unsigned long long)hash);
+        if (load_entry(path)) {
+            free(path);
+            free(dir);
+            free(source);
+            return;
+        }
+        // an invalid entry is deleted, so that it is written again below
+        unlink(path);
+    }
+
+    uint32_t start = this_inst();
+    // fmemopen() doesn't accept an empty buffer
+    FILE *f = size != 0 ? fmemopen(source, size, "r") : NULL;
+    if (f != NULL) {
+        parser_set_source(f, file_name);
+        while (read_expr(f) != UINT32_MAX)
+            ;
+        parser_set_source(NULL, NULL);
+        fclose(f);
+    } else if (size != 0) {
+        eprintf("Error: could not read file %s\n", file_name);
+        exit(1);
+    }
+    uint32_t end = this_inst();
+    insts[next_inst()] = (Inst){INST_EOF};
+    if (dir != NULL)
+        save_entry(dir, path, start, end);
+    free(path);
+    free(dir);
+    free(source);
+}
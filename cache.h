@@ -0,0 +1,13 @@
+#include "types.h"
+
+/* == cache.h
+ * The compilation cache keeps the bytecode of the Scheme files which are run,
+ * so that they're only compiled again once they or the compiler change.
+ * `compiler_hash` identifies the compiler. It's 0 until get_compiler_hash()
+ * computes it, and is restored by load_image().
+ */
+
+uint64_t compiler_hash;
+uint64_t get_compiler_hash(void);
+void cache_add_image(const char *file_name);
+void load_cached(const char *file_name, int cached);
@@ -1,60 +1,10 @@
-(define token-buffer '())
-
-(define (read-token)
-  (if (eq? token-buffer '())
-      (next-token)
-      (let ((token token-buffer))
-        (set! token-buffer '())
-        token)))
-
-(define (peek-token)
-  (if (eq? token-buffer '())
-      (set! token-buffer (next-token)))
-  token-buffer)
-
-(define hash 35)
-(define quote-char 39)
-(define left-paren 40)
-(define right-paren 41)
-(define period 46)
-
 (define (parse-and-compile)
   (compile-top-level (parse) #t))
 
+(define (quote-ident) (list 'quote 0 '()))
+
 (define (parse)
-  (let ((token (read-token)))
-    (if (pair? token)
-        (let ((id (cdr token)))
-          (cond ((= id left-paren)
-                 (parse-list))
-                ((= id right-paren)
-                 (error "Syntax error: unexpected ')'"))
-                ((= id quote-char)
-                 (list (lambda () (list 'quote 0 '())) (parse)))
-                ((= id period)
-                 (error "Syntax error: unexpected '.'"))
-                ((= id hash)
-                 (let ((x (parse)))
-                   (if (list? x)
-                       (list->vector x)
-                       (error "Syntax error: expected list or name after #"))))))
-        token)))
-
-(define (parse-list)
-  (let ((token (peek-token)))
-    (cond ((equal? token (cons 'token right-paren))
-           (read-token)
-           '())
-          ((equal? token (cons 'token period))
-           (read-token)
-           (let ((cdr-expr (parse)))
-             (if (not (equal? (read-token) (cons 'token right-paren)))
-                 (error "Syntax error: expected ')'"))
-             cdr-expr))
-          (else
-           (let ((head (parse)))
-             (let ((tail (parse-list)))
-               (cons head tail)))))))
+  (read-datum quote-ident))
 
 (define (compile-top-level expr tail)
   (let ((expanded (expand-to-define expr '())))
@@ -214,11 +164,21 @@
 
 (define (compile-appl expr env tail)
   (validate-expr expr '((f x ...)) '() env)
-  (for-each
-    (lambda (expr) (compile expr env #f))
-    expr)
-  ((if tail set-tail-call! set-call!)
-   (next-inst) (- (length expr) 1)))
+  (let ((inline-proc (and (ident? (car expr))
+                          (= (length expr) 3)
+                          (assq (locate-name (car expr) env) inline-procs))))
+    (if inline-proc
+        (begin
+          (compile (cadr expr) env #f)
+          (compile (caddr expr) env #f)
+          ((cadr inline-proc) (next-inst))
+          (put-tail! tail))
+        (begin
+          (for-each
+            (lambda (expr) (compile expr env #f))
+            expr)
+          ((if tail set-tail-call! set-call!)
+           (next-inst) (- (length expr) 1))))))
 
 (define (compile-set expr env tail)
   (validate-expr expr '((set! name expr)) '() env)
@@ -273,17 +233,22 @@
     (if (has-duplicates? args)
         (error "duplicate lambda parameter name"))
     (let ((jump-after (next-inst))
-          (lambda-address (this-inst)))
+          (lambda-address (this-inst))
+          (inner-lambdas lambdas-compiled))
       (compile-body (cddr expr) (cons (cons 'var args) env) #t)
       (let ((lambda-inst (next-inst))
             (variadic (not (equal-ident? args (cadr expr)))))
+        ;; The frame of the lambda can only escape if a lambda created in its body
+        ;; captures it, so if there is none, it can be kept on the stack.
         (set-lambda!
           lambda-inst
           variadic
           (if variadic
               (- (length args) 1)
               (length args))
-          lambda-address)
+          lambda-address
+          (= inner-lambdas lambdas-compiled))
+        (set! lambdas-compiled (+ lambdas-compiled 1))
         (set-jump! jump-after lambda-inst)
         (put-tail! tail)))))
 
@@ -433,6 +398,15 @@
     (list 'define error-define)
     (list 'define-syntax error-define-syntax)))
 
+;;; Calls of these globals with two arguments are compiled to dedicated instructions,
+;;; which are executed as regular calls if the global has been redefined.
+(define inline-procs
+  (list
+    (list '+ set-add!)
+    (list '- set-sub!)
+    (list '< set-lt!)
+    (list '= set-num-eq!)))
+
 (define derived-forms
   '((let ()
       (((((var val) ...) expr ...)
@@ -477,4 +451,6 @@
 
 (define shadowed-forms '())
 
+(define lambdas-compiled 0)
+
 (define macros '())
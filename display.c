@@ -45,7 +45,7 @@ static void print_val_(Val val0, int display_style) {
             break;
         case TYPE_LAMBDA:
             printf("<lambda with arity %"PRIu32"%s>",
-                    val.lambda_data->params & ~PARAMS_VARIADIC,
+                    val.lambda_data->params & ~(PARAMS_VARIADIC | PARAMS_STACK_FRAME),
                     val.lambda_data->params & PARAMS_VARIADIC ? "+" : "");
             break;
         case TYPE_PAIR:
@@ -78,12 +78,19 @@ static void print_val_(Val val0, int display_style) {
         case TYPE_BROKEN_HEART:
             printf("</broken heart/>");
             break;
+        case TYPE_HEADER:
+            printf("</object header/>");
+            break;
         case TYPE_ENV:
             printf("</environment at %p/>", val.env_data);
             break;
         case TYPE_INST:
             printf("</instruction pointer to %"PRIu32"/>", val.inst_data);
             break;
+        case TYPE_FRAME_INST:
+            printf("</instruction pointer to %"PRIu32" after frame of size %"PRIu32"/>",
+                    val.inst_data, val.frame_size);
+            break;
         case TYPE_GLOBAL_ENV:
             printf("</global environment at %p/>", val.global_env_data);
             break;
@@ -180,21 +187,99 @@ const char *type_name(Type type) {
     case TYPE_ENV:
         return "/environment/";
     case TYPE_INST:
+    case TYPE_FRAME_INST:
         return "/instruction pointer/";
     case TYPE_GLOBAL_ENV:
         return "/global environment/";
     case TYPE_PRINT_CONTROL:
         return "/print control/";
+    case TYPE_HEADER:
+        return "/object header/";
     }
     return "//INVALID TYPE//";
 }
 
+/* -- inst_name
+ * Returns the name of an instruction type.
+ */
+const char *inst_name(enum Inst_type type) {
+    switch (type) {
+    case INST_CONST:
+        return "CONST";
+    case INST_VAR:
+        return "VAR";
+    case INST_NAME:
+        return "NAME";
+    case INST_DEF:
+        return "DEF";
+    case INST_SET:
+        return "SET";
+    case INST_SET_NAME:
+        return "SET_NAME";
+    case INST_JUMP:
+        return "JUMP";
+    case INST_JUMP_FALSE:
+        return "JUMP_FALSE";
+    case INST_LAMBDA:
+        return "LAMBDA";
+    case INST_CALL:
+        return "CALL";
+    case INST_TAIL_CALL:
+        return "TAIL_CALL";
+    case INST_RETURN:
+        return "RETURN";
+    case INST_DELETE:
+        return "DELETE";
+    case INST_CONS:
+        return "CONS";
+    case INST_EXPR:
+        return "EXPR";
+    case INST_EOF:
+        return "EOF";
+    case INST_ADD:
+        return "ADD";
+    case INST_SUB:
+        return "SUB";
+    case INST_LT:
+        return "LT";
+    case INST_NUM_EQ:
+        return "NUM_EQ";
+    case INST_VAR_0:
+        return "VAR_0";
+    case INST_VAR_1:
+        return "VAR_1";
+    case INST_GLOBAL:
+        return "GLOBAL";
+    case INST_SET_0:
+        return "SET_0";
+    case INST_SET_1:
+        return "SET_1";
+    case INST_SET_GLOBAL:
+        return "SET_GLOBAL";
+    case INST_VAR_CALL:
+        return "VAR_CALL";
+    case INST_CALL_GLOBAL:
+        return "CALL_GLOBAL";
+    case INST_VAR_JUMP_FALSE:
+        return "VAR_JUMP_FALSE";
+    case INST_CONST_CALL:
+        return "CONST_CALL";
+    case INST_CONST_RETURN:
+        return "CONST_RETURN";
+    case INST_JIT:
+        return "JIT";
+    case INST_LAZY:
+        return "LAZY";
+    }
+    return "//INVALID INSTRUCTION//";
+}
+
 void print_inst(uint32_t n) {
     printf("%"PRIu32" ", n);
     switch (insts[n].type) {
     case INST_CONST:
         printf("CONST ");
-        print_val(insts[n].val);
+        print_val(consts[insts[n].index]);
         printf("\n");
         break;
     case INST_VAR:
@@ -202,12 +287,12 @@ void print_inst(uint32_t n) {
         break;
     case INST_NAME:
         printf("NAME ");
-        puts32(insts[n].name);
+        puts32(consts[insts[n].index].string_data);
         printf("\n");
         break;
     case INST_DEF:
         printf("DEF ");
-        puts32(insts[n].name);
+        puts32(consts[insts[n].index].string_data);
         printf("\n");
         break;
     case INST_SET:
@@ -215,7 +300,7 @@ void print_inst(uint32_t n) {
         break;
     case INST_SET_NAME:
         printf("SET_NAME ");
-        puts32(insts[n].name);
+        puts32(consts[insts[n].index].string_data);
         printf("\n");
         break;
     case INST_JUMP:
@@ -225,10 +310,11 @@ void print_inst(uint32_t n) {
         printf("JUMP_FALSE %"PRIu32"\n", insts[n].index);
         break;
     case INST_LAMBDA:
-        printf("LAMBDA %"PRIu32"%s %"PRIu32"\n",
-                insts[n].lambda.params & ~PARAMS_VARIADIC,
+        printf("LAMBDA %"PRIu32"%s %"PRIu32"%s\n",
+                insts[n].lambda.params & ~(PARAMS_VARIADIC | PARAMS_STACK_FRAME),
                 insts[n].lambda.params & PARAMS_VARIADIC ? "+" : "",
-                insts[n].lambda.index);
+                insts[n].lambda.index,
+                insts[n].lambda.params & PARAMS_STACK_FRAME ? " STACK_FRAME" : "");
         break;
     case INST_CALL:
         printf("CALL %"PRIu32"\n", insts[n].num);
@@ -251,5 +337,32 @@ void print_inst(uint32_t n) {
     case INST_EOF:
         printf("EOF\n");
         break;
+    case INST_ADD:
+    case INST_SUB:
+    case INST_LT:
+    case INST_NUM_EQ:
+        printf("%s\n", inst_name(insts[n].type));
+        break;
+    case INST_VAR_0:
+    case INST_VAR_1:
+    case INST_GLOBAL:
+    case INST_SET_0:
+    case INST_SET_1:
+    case INST_SET_GLOBAL:
+    case INST_VAR_CALL:
+    case INST_CALL_GLOBAL:
+    case INST_VAR_JUMP_FALSE:
+        printf("%s %"PRIu32" %"PRIu32"\n", inst_name(insts[n].type), insts[n].var.frame, insts[n].var.index);
+        break;
+    case INST_CONST_CALL:
+    case INST_CONST_RETURN:
+        printf("%s ", inst_name(insts[n].type));
+        print_val(consts[insts[n].index]);
+        printf("\n");
+        break;
+    case INST_JIT:
+    case INST_LAZY:
+        printf("%s %"PRIu32"\n", inst_name(insts[n].type), insts[n].index);
+        break;
     }
 }
@@ -3,4 +3,5 @@
 void print_val(Val val);
 const char *type_name(Type);
 void display_val(Val val);
+const char *inst_name(enum Inst_type type);
 void print_inst(uint32_t n);
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emit_c.h"
+#include "insts.h"
+#include "safestd.h"
+#include "types.h"
+
+/* == emit_c.c
+ * The C file written by emit_c() contains the program as bytecode, and the
+ * body of each of its lambdas translated to a C function, which does the same
+ * as the machine code of the JIT compiler: it exits to the interpreter at the
+ * instructions it doesn't handle and when a guard fails, and its calls of
+ * lambdas are made by trampolines which resume it after the call. The C
+ * compiler then keeps the stack in registers and optimizes across instructions.
+ * Each instruction is written as a macro of aot.h, given by its position
+ * relative to the start of the program, since it's loaded after compiler.sss.
+ *
+ * Like the JIT compiler, the bodies are only translated if they don't jump
+ * backwards, which allows checking the stack space once on entry. The only
+ * jumps out of a body allowed are those to its end, where the function exits.
+ */
+
+/* -- translatable
+ * Returns whether the body from `body` to `end` only jumps forward within it,
+ * or to `end`.
+ */
+static int translatable(uint32_t body, uint32_t end) {
+    for (uint32_t pc = body; pc < end; pc++) {
+        enum Inst_type type = generic_type(insts[pc].type);
+        if ((type == INST_JUMP || type == INST_JUMP_FALSE) && (insts[pc].index <= pc || insts[pc].index > end))
+            return 0;
+    }
+    return 1;
+}
+
+// a call is resumed by a trampoline unless it ends the body
+static int resumed_call(uint32_t pc, uint32_t end) {
+    return generic_type(insts[pc].type) == INST_CALL && pc + 1 < end;
+}
+
+static void emit_bytecode(FILE *fp, uint32_t start, uint32_t end) {
+    char *bytecode;
+    size_t size;
+    FILE *mem = open_memstream(&bytecode, &size);
+    if (mem == NULL) {
+        eprintf("Error: could not write bytecode to memory\n");
+        exit(1);
+    }
+    save_insts(mem, start, end);
+    fclose(mem);
+    fprintf(fp, "const unsigned char aot_bytecode[] = {");
+    for (size_t i = 0; i < size; i++)
+        fprintf(fp, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", (unsigned char)bytecode[i]);
+    fprintf(fp, "\n};\nconst size_t aot_bytecode_size = sizeof(aot_bytecode);\n");
+    free(bytecode);
+}
+
+static void emit_inst(FILE *fp, uint32_t start, uint32_t pc, uint32_t end, uint32_t *calls) {
+    uint32_t n = pc - start;
+    Inst inst = insts[pc];
+    switch (generic_type(inst.type)) {
+    case INST_CONST:
+        // fixnums and booleans are written out, like the JIT compiler does
+        if (consts[inst.index].type == TYPE_INT || consts[inst.index].type == TYPE_BOOL)
+            fprintf(fp, "    AOT_PUSH(((Val){%s, {.int_data = (long long)%lluULL}}));\n",
+                    consts[inst.index].type == TYPE_INT ? "TYPE_INT" : "TYPE_BOOL",
+                    (unsigned long long)consts[inst.index].int_data);
+        else
+            fprintf(fp, "    AOT_CONST(%u);\n", n);
+        break;
+    case INST_VAR:
+        if (inst.var.frame == UINT32_MAX)
+            fprintf(fp, "    AOT_GLOBAL(%u);\n", n);
+        else
+            fprintf(fp, "    AOT_VAR(%u, %u, %u);\n", n, inst.var.frame, inst.var.index);
+        break;
+    case INST_NAME:
+        fprintf(fp, "    AOT_GLOBAL(%u);\n", n);
+        break;
+    case INST_JUMP:
+        fprintf(fp, "    goto pc_%u;\n", inst.index - start);
+        break;
+    case INST_JUMP_FALSE:
+        fprintf(fp, "    AOT_JUMP_FALSE(pc_%u);\n", inst.index - start);
+        break;
+    case INST_DELETE:
+        fprintf(fp, "    sp--;\n");
+        break;
+    case INST_EXPR:
+        break;
+    case INST_ADD:
+        fprintf(fp, "    AOT_ADD(%u);\n", n);
+        break;
+    case INST_SUB:
+        fprintf(fp, "    AOT_SUB(%u);\n", n);
+        break;
+    case INST_LT:
+        fprintf(fp, "    AOT_LT(%u);\n", n);
+        break;
+    case INST_NUM_EQ:
+        fprintf(fp, "    AOT_NUM_EQ(%u);\n", n);
+        break;
+    case INST_CALL:
+        if (resumed_call(pc, end))
+            fprintf(fp, "    AOT_CALL(%u, %u, aot_calls[%u]);\n", n, inst.num, (*calls)++);
+        else
+            fprintf(fp, "    AOT_CALL(%u, %u, AOT_PC(%u));\n", n, inst.num, n);
+        break;
+    case INST_TAIL_CALL:
+        fprintf(fp, "    AOT_TAIL_CALL(%u, %u);\n", n, inst.num);
+        break;
+    default:
+        fprintf(fp, "    AOT_EXIT(%u);\n", n);
+        break;
+    }
+}
+
+/* -- emit_lambda
+ * Writes the function running the body from `body` to `end`, which takes
+ * the instruction to start at, and the functions entering it at the body
+ * and after each call, which are installed by aot_register().
+ */
+static void emit_lambda(FILE *fp, uint32_t start, uint32_t body, uint32_t end, uint32_t *calls) {
+    uint32_t b = body - start;
+    char *labels = calloc(end - body + 1, 1);
+    if (labels == NULL) {
+        eprintf("Error: out of memory\n");
+        exit(1);
+    }
+    for (uint32_t pc = body; pc < end; pc++) {
+        enum Inst_type type = generic_type(insts[pc].type);
+        if (type == INST_JUMP || type == INST_JUMP_FALSE)
+            labels[insts[pc].index - body] = 1;
+        else if (resumed_call(pc, end))
+            labels[pc + 1 - body] = 1;
+    }
+
+    fprintf(fp, "\nstatic uint32_t lambda_%u(uint32_t entry) {\n", b);
+    fprintf(fp, "    Val *sp = stack_ptr;\n");
+    fprintf(fp, "    AOT_CHECK_STACK(entry, %u);\n", end - body);
+    fprintf(fp, "    switch (entry) {\n");
+    for (uint32_t pc = body; pc < end; pc++)
+        if (resumed_call(pc, end))
+            fprintf(fp, "    case %u: goto pc_%u;\n", pc + 1 - start, pc + 1 - start);
+    fprintf(fp, "    }\n");
+    for (uint32_t pc = body; pc < end; pc++) {
+        if (labels[pc - body])
+            fprintf(fp, "pc_%u:\n", pc - start);
+        emit_inst(fp, start, pc, end, calls);
+    }
+    if (labels[end - body])
+        fprintf(fp, "pc_%u:\n", end - start);
+    fprintf(fp, "    AOT_EXIT(%u);\n}\n\n", end - start);
+    free(labels);
+
+    fprintf(fp, "static uint32_t enter_%u(void) {\n    return lambda_%u(%u);\n}\n", b, b, b);
+    for (uint32_t pc = body; pc < end; pc++)
+        if (resumed_call(pc, end))
+            fprintf(fp, "\nstatic uint32_t resume_%u_%u(void) {\n    return lambda_%u(%u);\n}\n",
+                    b, pc + 1 - start, b, pc + 1 - start);
+}
+
+/* -- emit_c
+ * Writes the C file for the program from `start` to `end`.
+ */
+void emit_c(FILE *fp, uint32_t start, uint32_t end) {
+    load_lazy_lambdas(start, end);
+    uint32_t calls_num = 0;
+    for (uint32_t pc = start; pc < end; pc++) {
+        if (insts[pc].type != INST_LAMBDA || !translatable(insts[pc].lambda.index, pc))
+            continue;
+        for (uint32_t call = insts[pc].lambda.index; call < pc; call++)
+            calls_num += (uint32_t)resumed_call(call, pc);
+    }
+
+    fprintf(fp, "#include \"aot.h\"\n\n");
+    emit_bytecode(fp, start, end);
+    fprintf(fp, "\nstatic uint32_t aot_start;\n");
+    // an array can't be empty
+    fprintf(fp, "static uint32_t aot_calls[%u];\n", calls_num + 1);
+    uint32_t calls = 0;
+    for (uint32_t pc = start; pc < end; pc++)
+        if (insts[pc].type == INST_LAMBDA && translatable(insts[pc].lambda.index, pc))
+            emit_lambda(fp, start, insts[pc].lambda.index, pc, &calls);
+
+    fprintf(fp, "\nvoid aot_register(uint32_t start) {\n");
+    fprintf(fp, "    aot_start = start;\n");
+    calls = 0;
+    for (uint32_t pc = start; pc < end; pc++) {
+        if (insts[pc].type != INST_LAMBDA || !translatable(insts[pc].lambda.index, pc))
+            continue;
+        uint32_t body = insts[pc].lambda.index;
+        fprintf(fp, "    set_native_code(AOT_PC(%u), enter_%u);\n", body - start, body - start);
+        for (uint32_t call = body; call < pc; call++)
+            if (resumed_call(call, pc))
+                fprintf(fp, "    aot_calls[%u] = add_trampoline(AOT_PC(%u), resume_%u_%u);\n",
+                        calls++, call - start, body - start, call + 1 - start);
+    }
+    fprintf(fp, "}\n");
+}
@@ -0,0 +1,15 @@
+#include <stdio.h>
+
+#include "types.h"
+
+/* == emit_c.h
+ * --emit-c translates a program to a C file, which is compiled together with
+ * the interpreter with AOT defined to produce an executable running it.
+ * The C file defines `aot_bytecode`, holding the program, and aot_register(),
+ * which installs the translated lambdas once it's loaded at `start`.
+ */
+
+void emit_c(FILE *fp, uint32_t start, uint32_t end);
+extern const unsigned char aot_bytecode[];
+extern const size_t aot_bytecode_size;
+void aot_register(uint32_t start);
@@ -10,6 +10,7 @@
 #include "primitives.h"
 #include "safestd.h"
 #include "string.h"
+#include "vm_stats.h"
 
 /* -- execution_env
  * The global environment in which programs are executed.
@@ -21,6 +22,44 @@ Global_env *execution_env;
  */
 Global_env *compiler_env;
 
+/* -- hash_name
+ * Hashes an interned name. Since names are interned, their addresses
+ * are enough to tell them apart.
+ */
+static uint32_t hash_name(String *var) {
+    return (uint32_t)(((uint64_t)(uintptr_t)var * 0x9E3779B97F4A7C15) >> 32);
+}
+
+/* -- find_index_entry
+ * Returns the entry of the index of a global environment which holds
+ * the binding of `var`, or the empty entry where it should be inserted.
+ */
+static uint32_t *find_index_entry(String *var, Global_env *global) {
+    uint32_t mask = global->index_capacity - 1;
+    for (uint32_t i = hash_name(var) & mask; ; i = (i + 1) & mask) {
+        uint32_t *entry = &global->index[i];
+        if (*entry == UINT32_MAX || global->bindings[*entry].var == var)
+            return entry;
+    }
+}
+
+/* -- rebuild_index
+ * Rebuilds the index of a global environment so that it has twice as many
+ * entries as there is room for bindings.
+ * If a name is bound more than once, the first binding is used.
+ */
+static void rebuild_index(Global_env *global) {
+    free(global->index);
+    global->index_capacity = 2 * global->capacity;
+    global->index = s_malloc(global->index_capacity * sizeof(uint32_t));
+    memset(global->index, 0xFF, global->index_capacity * sizeof(uint32_t));
+    for (uint32_t i = 0; i < global->size; i++) {
+        uint32_t *entry = find_index_entry(global->bindings[i].var, global);
+        if (*entry == UINT32_MAX)
+            *entry = i;
+    }
+}
+
 /* -- make_global_env
  * Creates a global environment with the specified primitives.
  */
@@ -43,6 +82,8 @@ Global_env *make_global_env(int include_r5rs, int include_compiler) {
         memcpy(p, compiler_bindings, compiler_bindings_size * sizeof(Binding));
         p += compiler_bindings_size;
     }
+    env->index = NULL;
+    rebuild_index(env);
     return env;
 }
 
@@ -55,6 +96,7 @@ void setup_env(void) {
  * Finds a value bound to a location in a given environment.
  */
 Val locate_var(Env_loc var, Env *env, Global_env *global) {
+    VM_STAT(count_frame_depth(var.frame));
     if (var.frame == UINT32_MAX)
         return global->bindings[var.index].val;
     Env *frame = env;
@@ -68,9 +110,9 @@ Val locate_var(Env_loc var, Env *env, Global_env *global) {
  * Exits with an error if the name is unbound.
  */
 uint32_t locate_global_var(String *var, Global_env *global) {
-    for (uint32_t i = 0; i < global->size; i++)
-        if (global->bindings[i].var == var)
-            return i;
+    uint32_t index = *find_index_entry(var, global);
+    if (index != UINT32_MAX)
+        return index;
     eprintf("Error: unbound variable ");
     eputs32(var);
     eprintf("\n");
@@ -83,12 +125,14 @@ uint32_t locate_global_var(String *var, Global_env *global) {
 void assign_var(Env_loc var, Val val, Env *env, Global_env *global) {
     if (var.frame == UINT32_MAX) {
         global->bindings[var.index].val = val;
+        gc_global_write_barrier(global, var.index);
         return;
     }
     Env *frame = env;
     for (uint32_t n = var.frame; n > 0; n--)
         frame = frame->outer;
     frame->vals[var.index] = val;
+    gc_write_barrier(&frame->vals[var.index]);
 }
 
 /* -- define_var
@@ -96,17 +140,21 @@ void assign_var(Env_loc var, Val val, Env *env, Global_env *global) {
  * Changes the binding if one already exists.
  */
 void define_var(String *var, Val val, Global_env *global) {
-    for (uint32_t i = 0; i < global->size; i++) {
-        if (global->bindings[i].var == var) {
-            global->bindings[i].val = val;
-            return;
-        }
+    uint32_t *entry = find_index_entry(var, global);
+    if (*entry != UINT32_MAX) {
+        global->bindings[*entry].val = val;
+        gc_global_write_barrier(global, *entry);
+        return;
     }
     if (global->size == global->capacity) {
         global->capacity *= 2;
         global->bindings = s_realloc(global->bindings, global->capacity * sizeof(Binding));
+        rebuild_index(global);
+        entry = find_index_entry(var, global);
     }
-    global->bindings[global->size++] = (Binding){val, var};
+    *entry = global->size;
+    global->bindings[global->size] = (Binding){val, var};
+    gc_global_write_barrier(global, global->size++);
 }
 
 /* -- extend_env
@@ -115,7 +163,7 @@ void define_var(String *var, Val val, Global_env *global) {
  */
 Env *extend_env(Val *vals_start, uint32_t vals_num, Env *env) {
     gc_lock_env(&env);
-    Env *ext_env = gc_alloc(sizeof(Env) + vals_num * sizeof(Val));
+    Env *ext_env = gc_alloc(TYPE_ENV, sizeof(Env) + vals_num * sizeof(Val));
     gc_unlock_env();
     ext_env->outer = env;
     ext_env->size = vals_num;
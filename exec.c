@@ -1,18 +1,69 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "exec.h"
+#include "alloc_profile.h"
 #include "exec_gc.h"
 #include "exec_stack.h"
 #include "types.h"
 #include "env.h"
 #include "display.h"
 #include "insts.h"
+#include "jit.h"
 #include "memory.h"
+#include "primitives.h"
+#include "profile.h"
+#include "vm_stats.h"
 #include "primitives/assert.h"
+#include "primitives/number.h"
 
-#ifndef STACK_SIZE
-#define STACK_SIZE 65536
+/* -- PROFILE_ALLOC
+ * Marks the current instruction as the allocation site of the objects
+ * allocated by it if the allocation profiler is enabled.
+ */
+#ifdef ALLOC_PROFILE
+#define PROFILE_ALLOC alloc_pc = pc
+#else
+#define PROFILE_ALLOC
+#endif
+
+/* -- dispatch
+ * If the compiler supports labels as values (GCC and Clang do), `exec` jumps
+ * directly from the end of each instruction handler to the handler of the next
+ * instruction through `dispatch_table`. This avoids the bounds check of the
+ * switch statement and gives every handler its own indirect branch, which is
+ * much easier for the processor to predict.
+ * Otherwise, or if SWITCH_DISPATCH is defined, a plain switch statement is used.
+ * The macros below let the same handler code compile in both modes:
+ * - DISPATCH_BEGIN / DISPATCH_END surround the handlers.
+ * - CASE(inst) begins the handler for the given instruction type.
+ * - NEXT ends a handler and dispatches the instruction at `pc`.
+ * - DEFAULT begins the handler for invalid instructions.
+ * If VM_STATS is defined, every dispatched instruction is counted.
+ */
+#if defined(__GNUC__) && !defined(SWITCH_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+#ifdef VM_STATS
+#define COUNT_INST count_inst(insts[pc].type)
+#else
+#define COUNT_INST
+#endif
+
+#ifdef THREADED_DISPATCH
+#define DISPATCH_BEGIN NEXT;
+#define DISPATCH_END
+#define CASE(inst) label_##inst
+#define NEXT COUNT_INST; goto *dispatch_table[insts[pc].type]
+#define DEFAULT label_invalid
+#else
+#define DISPATCH_BEGIN while (1) { COUNT_INST; switch (insts[pc].type) {
+#define DISPATCH_END }}
+#define CASE(inst) case inst
+#define NEXT break
+#define DEFAULT default
 #endif
 
 Val stack[STACK_SIZE];
@@ -38,12 +89,14 @@ Val stack_pop(void) {
  * It also checks if the number of arguments is correct.
  */
 static uint32_t adjust_args(uint32_t stack_args, uint32_t req_args) {
+    req_args &= ~PARAMS_STACK_FRAME;
     if (req_args & PARAMS_VARIADIC) {
         req_args &= ~PARAMS_VARIADIC;
         args_assert(stack_args >= req_args);
         stack_push((Val){TYPE_NIL});
+        VM_STAT(vm_stats.variadic_conses += stack_args - req_args);
         for (uint32_t i = 0; i < stack_args - req_args; i++) {
-            Pair *pair = gc_alloc(sizeof(Pair));
+            Pair *pair = gc_alloc(TYPE_PAIR, sizeof(Pair));
             pair->cdr = stack_pop();
             pair->car = stack_pop();
             stack_push((Val){TYPE_PAIR, {.pair_data = pair}});
@@ -55,193 +108,470 @@ static uint32_t adjust_args(uint32_t stack_args, uint32_t req_args) {
     }
 }
 
+/* -- check_defined
+ * Exits with an error if the value of a variable is used before it's defined,
+ * except in the environment of the compiler.
+ */
+static inline void check_defined(Val val) {
+    if (val.type == TYPE_UNDEF && global_env != compiler_env) {
+        eprintf("Error: use of undefined value\n");
+        exit(1);
+    }
+}
+
+/* -- insert_operator
+ * Inserts a procedure below the two arguments on top of the stack,
+ * so that an inlined instruction can be executed as a call of it.
+ */
+static void insert_operator(Val op) {
+    stack_push(stack_ptr[-1]);
+    stack_ptr[-2] = stack_ptr[-3];
+    stack_ptr[-3] = op;
+}
+
+/* -- INLINE_GUARD
+ * Executes an inlined instruction as a call of the global bound at `binding`
+ * if it is no longer the primitive `prim`.
+ */
+#define INLINE_GUARD(binding, prim) do { \
+        Val op = global_env->bindings[binding].val; \
+        if (op.type != TYPE_PRIM || op.prim_data != prim) { \
+            insert_operator(op); \
+            goto do_call; \
+        } \
+    } while (0)
+
+/* -- enter_lambda
+ * Returns the instruction at which to continue after entering the lambda
+ * whose body starts at `body`, running its machine code if it has been
+ * compiled, or compiling it once the lambda has been called often enough.
+ */
+static inline uint32_t enter_lambda(uint32_t body) {
+#ifdef NATIVE_CODE
+    if (body >= jit_entries_size)
+        grow_jit_entries();
+    Jit_entry *entry = &jit_entries[body];
+    if (entry->code != NULL)
+        return entry->code();
+#ifdef JIT
+    if (++entry->calls == JIT_THRESHOLD)
+        return jit_compile(body);
+#endif
+#endif
+    return body;
+}
+
+/* -- push_stack_frame
+ * Turns the lambda at `op` and the `vals_num` values above it into
+ * a frame on the stack (see Env), and returns it.
+ */
+static Env *push_stack_frame(Val *op, uint32_t vals_num, Env *caller_env, uint32_t ret) {
+    *op = (Val){TYPE_ENV, {.env_data = op->lambda_data->env}};
+    stack_push((Val){TYPE_ENV, {.env_data = caller_env}});
+    stack_push((Val){TYPE_FRAME_INST, {.inst_data = ret, .frame_size = vals_num}});
+    return (Env *)op;
+}
+
 /* -- exec
  * Executes the virtual machine instructions, starting at `inst`.
  */
 Val exec(uint32_t pc, Global_env *init_global_env) {
+#ifdef THREADED_DISPATCH
+    static void *dispatch_table[] = {
+        [INST_CONST] = &&label_INST_CONST,
+        [INST_VAR] = &&label_INST_VAR,
+        [INST_NAME] = &&label_INST_NAME,
+        [INST_DEF] = &&label_INST_DEF,
+        [INST_SET] = &&label_INST_SET,
+        [INST_SET_NAME] = &&label_INST_SET_NAME,
+        [INST_JUMP] = &&label_INST_JUMP,
+        [INST_JUMP_FALSE] = &&label_INST_JUMP_FALSE,
+        [INST_LAMBDA] = &&label_INST_LAMBDA,
+        [INST_CALL] = &&label_INST_CALL,
+        [INST_TAIL_CALL] = &&label_INST_TAIL_CALL,
+        [INST_RETURN] = &&label_INST_RETURN,
+        [INST_DELETE] = &&label_INST_DELETE,
+        [INST_CONS] = &&label_INST_CONS,
+        [INST_EXPR] = &&label_INST_EXPR,
+        [INST_EOF] = &&label_invalid,
+        [INST_ADD] = &&label_INST_ADD,
+        [INST_SUB] = &&label_INST_SUB,
+        [INST_LT] = &&label_INST_LT,
+        [INST_NUM_EQ] = &&label_INST_NUM_EQ,
+        [INST_VAR_0] = &&label_INST_VAR_0,
+        [INST_VAR_1] = &&label_INST_VAR_1,
+        [INST_GLOBAL] = &&label_INST_GLOBAL,
+        [INST_SET_0] = &&label_INST_SET_0,
+        [INST_SET_1] = &&label_INST_SET_1,
+        [INST_SET_GLOBAL] = &&label_INST_SET_GLOBAL,
+        [INST_VAR_CALL] = &&label_INST_VAR_CALL,
+        [INST_CALL_GLOBAL] = &&label_INST_CALL_GLOBAL,
+        [INST_VAR_JUMP_FALSE] = &&label_INST_VAR_JUMP_FALSE,
+        [INST_CONST_CALL] = &&label_INST_CONST_CALL,
+        [INST_CONST_RETURN] = &&label_INST_CONST_RETURN,
+#ifdef NATIVE_CODE
+        [INST_JIT] = &&label_INST_JIT,
+#else
+        [INST_JIT] = &&label_invalid,
+#endif
+        [INST_LAZY] = &&label_INST_LAZY,
+    };
+#endif
     stack_ptr = stack;
     global_env = init_global_env;
     exec_env = NULL;
-    while (1) {
-        switch (insts[pc].type) {
+    DISPATCH_BEGIN
 
-        case INST_CONST:
-            stack_push(insts[pc++].val);
-            break;
+    CASE(INST_CONST):
+        stack_push(consts[insts[pc++].index]);
+        NEXT;
 
-        case INST_VAR:
-            stack_push(locate_var(insts[pc++].var, exec_env, global_env));
-            if (stack_ptr[-1].type == TYPE_UNDEF && global_env != compiler_env) {
-                eprintf("Error: use of undefined value\n");
-                exit(1);
-            }
-            break;
+    CASE(INST_VAR):
+        stack_push(locate_var(insts[pc++].var, exec_env, global_env));
+        check_defined(stack_ptr[-1]);
+        NEXT;
 
-        case INST_NAME: {
-            uint32_t index = locate_global_var(insts[pc].name, global_env);
-            insts[pc] = (Inst){INST_VAR, {.var = (Env_loc){UINT32_MAX, index}}};
-            break;
-        }
+    CASE(INST_NAME): {
+        uint32_t index = locate_global_var(consts[insts[pc].index].string_data, global_env);
+        insts[pc] = (Inst){INST_VAR, {.var = (Env_loc){UINT32_MAX, index}}};
+        insts[pc].type = specialized_type(pc);
+        NEXT;
+    }
 
-        case INST_DEF:
-            define_var(insts[pc++].name, stack_pop(), global_env);
-            stack_push((Val){TYPE_VOID});
-            break;
+    CASE(INST_DEF):
+        define_var(consts[insts[pc++].index].string_data, stack_pop(), global_env);
+        stack_push((Val){TYPE_VOID});
+        NEXT;
 
-        case INST_SET:
-            assign_var(insts[pc++].var, stack_pop(), exec_env, global_env);
-            stack_push((Val){TYPE_VOID});
-            break;
+    CASE(INST_SET):
+        assign_var(insts[pc++].var, stack_pop(), exec_env, global_env);
+        stack_push((Val){TYPE_VOID});
+        NEXT;
 
-        case INST_SET_NAME: {
-            uint32_t index = locate_global_var(insts[pc].name, global_env);
-            insts[pc] = (Inst){INST_SET, {.var = (Env_loc){UINT32_MAX, index}}};
-            break;
-        }
+    CASE(INST_SET_NAME): {
+        uint32_t index = locate_global_var(consts[insts[pc].index].string_data, global_env);
+        insts[pc] = (Inst){INST_SET, {.var = (Env_loc){UINT32_MAX, index}}};
+        insts[pc].type = specialized_type(pc);
+        NEXT;
+    }
 
-        case INST_JUMP:
+    CASE(INST_JUMP):
+        pc = insts[pc].index;
+        NEXT;
+
+    CASE(INST_JUMP_FALSE): {
+        Val v = stack_pop();
+        if (v.type == TYPE_BOOL && v.int_data == 0)
             pc = insts[pc].index;
-            break;
+        else
+            pc++;
+        NEXT;
+    }
 
-        case INST_JUMP_FALSE: {
-            Val v = stack_pop();
-            if (v.type == TYPE_BOOL && v.int_data == 0)
-                pc = insts[pc].index;
-            else
-                pc++;
-            break;
-        }
+    CASE(INST_LAMBDA): {
+        PROFILE_ALLOC;
+        Lambda *lambda = gc_alloc(TYPE_LAMBDA, sizeof(Lambda));
+        lambda->params = insts[pc].lambda.params;
+        lambda->body = insts[pc].lambda.index;
+        lambda->env = exec_env;
+        stack_push((Val){TYPE_LAMBDA, {.lambda_data = lambda}});
+        pc++;
+        NEXT;
+    }
 
-        case INST_LAMBDA: {
-            Lambda *lambda = gc_alloc(sizeof(Lambda));
-            lambda->params = insts[pc].lambda.params;
-            lambda->body = insts[pc].lambda.index;
-            lambda->env = exec_env;
-            stack_push((Val){TYPE_LAMBDA, {.lambda_data = lambda}});
+    CASE(INST_CALL): {
+    do_call:
+        PROFILE_ALLOC;
+        if (profile_pending)
+            take_profile_sample(pc, stack, stack_ptr);
+        Val *op = stack_ptr - insts[pc].num - 1;
+        switch (op->type) {
+        case TYPE_PRIM: {
+            VM_STAT(vm_stats.prim_calls++);
+            Val result = op->prim_data(op + 1, insts[pc].num);
+            stack_ptr = op;
+            stack_push(result);
             pc++;
             break;
         }
-
-        case INST_CALL: {
-            Val *op = stack_ptr - insts[pc].num - 1;
-            switch (op->type) {
-            case TYPE_PRIM: {
-                Val result = op->prim_data(op + 1, insts[pc].num);
-                stack_ptr = op;
-                stack_push(result);
-                pc++;
-                break;
-            }
-            case TYPE_LAMBDA: {
-                uint32_t vals_num = adjust_args(insts[pc].num, op->lambda_data->params);
-                uint32_t new_pc = op->lambda_data->body;
-                Env *lambda_env = extend_env(op + 1, vals_num, op->lambda_data->env);
-                stack_ptr = op;
-                stack_push((Val){TYPE_ENV, {.env_data = exec_env}});
-                stack_push((Val){TYPE_INST, {.inst_data = pc + 1}});
-                exec_env = lambda_env;
-                pc = new_pc;
+        case TYPE_LAMBDA: {
+            VM_STAT(vm_stats.lambda_calls++);
+            uint32_t vals_num = adjust_args(insts[pc].num, op->lambda_data->params);
+            uint32_t new_pc = op->lambda_data->body;
+            if (op->lambda_data->params & PARAMS_STACK_FRAME) {
+                VM_STAT(vm_stats.stack_frames++);
+                exec_env = push_stack_frame(op, vals_num, exec_env, pc + 1);
+                pc = enter_lambda(new_pc);
                 break;
             }
-            case TYPE_HIGH_PRIM: {
-                stack_push((Val){}); // ensure error in case of overflow
-                stack_push((Val){});
-                stack_pop();
-                stack_pop();
-                for (Val *arg_ptr = stack_ptr - 1; arg_ptr > op; arg_ptr--)
-                    *(arg_ptr + 2) = *arg_ptr;
-                stack_ptr += 2;
-                High_prim *high_prim = op->high_prim_data;
-                *(op + 2) = *op;
-                *op = (Val){TYPE_ENV, {.env_data = exec_env}};
-                *(op + 1) = (Val){TYPE_INST, {.inst_data = pc + 1}};
-                High_prim_return r = high_prim(op + 3, insts[pc].num);
-                if (r.global_env != NULL && r.global_env != global_env) {
-                    stack_push((Val){TYPE_GLOBAL_ENV, {.global_env_data = global_env}});
-                    global_env = r.global_env;
-                }
-                pc = r.pc;
-                break;
-            }
-            default:
-                eprintf("Error: %s is not an applicable type\n", type_name(op->type));
-                exit(1);
+            Env *lambda_env = extend_env(op + 1, vals_num, op->lambda_data->env);
+            stack_ptr = op;
+            stack_push((Val){TYPE_ENV, {.env_data = exec_env}});
+            stack_push((Val){TYPE_INST, {.inst_data = pc + 1}});
+            exec_env = lambda_env;
+            pc = enter_lambda(new_pc);
+            break;
+        }
+        case TYPE_HIGH_PRIM: {
+            VM_STAT(vm_stats.high_prim_calls++);
+            stack_push((Val){}); // ensure error in case of overflow
+            stack_push((Val){});
+            stack_pop();
+            stack_pop();
+            for (Val *arg_ptr = stack_ptr - 1; arg_ptr > op; arg_ptr--)
+                *(arg_ptr + 2) = *arg_ptr;
+            stack_ptr += 2;
+            High_prim *high_prim = op->high_prim_data;
+            *(op + 2) = *op;
+            *op = (Val){TYPE_ENV, {.env_data = exec_env}};
+            *(op + 1) = (Val){TYPE_INST, {.inst_data = pc + 1}};
+            High_prim_return r = high_prim(op + 3, insts[pc].num);
+            if (r.global_env != NULL && r.global_env != global_env) {
+                stack_push((Val){TYPE_GLOBAL_ENV, {.global_env_data = global_env}});
+                global_env = r.global_env;
             }
+            pc = r.pc;
             break;
         }
+        default:
+            eprintf("Error: %s is not an applicable type\n", type_name(op->type));
+            exit(1);
+        }
+        NEXT;
+    }
 
-        case INST_TAIL_CALL: {
-            Val *op = stack_ptr - insts[pc].num - 1;
-            switch (op->type) {
-            case TYPE_PRIM: {
-                Val result = op->prim_data(op + 1, insts[pc].num);
-                stack_ptr = op;
-                stack_push(result);
-                pc = return_inst;
-                break;
+    CASE(INST_TAIL_CALL): {
+        PROFILE_ALLOC;
+        if (profile_pending)
+            take_profile_sample(pc, stack, stack_ptr);
+        Val *op = stack_ptr - insts[pc].num - 1;
+        switch (op->type) {
+        case TYPE_PRIM: {
+            VM_STAT(vm_stats.prim_calls++);
+            Val result = op->prim_data(op + 1, insts[pc].num);
+            stack_ptr = op;
+            stack_push(result);
+            pc = return_inst;
+            break;
+        }
+        case TYPE_LAMBDA: {
+            VM_STAT(vm_stats.lambda_calls++);
+            uint32_t vals_num = adjust_args(insts[pc].num, op->lambda_data->params);
+            uint32_t new_pc = op->lambda_data->body;
+            // the return address of the caller is reused, and its frame dropped if it's on the stack
+            Val *frame = op;
+            uint32_t ret = return_inst;
+            if (op > stack + 1 && (op[-1].type == TYPE_INST || op[-1].type == TYPE_FRAME_INST)) {
+                ret = op[-1].inst_data;
+                frame = op[-1].type == TYPE_INST ? op - 2 : op - 3 - op[-1].frame_size;
             }
-            case TYPE_LAMBDA: {
-                uint32_t vals_num = adjust_args(insts[pc].num, op->lambda_data->params);
+            if (op->lambda_data->params & PARAMS_STACK_FRAME) {
+                VM_STAT(vm_stats.stack_frames++);
+                Env *caller_env = frame == op ? exec_env : op[-2].env_data;
+                memmove(frame, op, (vals_num + 1) * sizeof(Val));
+                stack_ptr = frame + vals_num + 1;
+                exec_env = push_stack_frame(frame, vals_num, caller_env, ret);
+            } else {
                 exec_env = extend_env(op + 1, vals_num, op->lambda_data->env);
                 stack_ptr = op;
-                pc = op->lambda_data->body;
-                break;
-            }
-            case TYPE_HIGH_PRIM: {
-                High_prim_return r = op->high_prim_data(op + 1, insts[pc].num);
-                if (r.global_env != NULL && r.global_env != global_env) {
-                    stack_push((Val){TYPE_GLOBAL_ENV, {.global_env_data = global_env}});
-                    global_env = r.global_env;
+                if (frame != op && op[-1].type == TYPE_FRAME_INST) {
+                    Val caller_env = op[-2];
+                    stack_ptr = frame;
+                    stack_push(caller_env);
+                    stack_push((Val){TYPE_INST, {.inst_data = ret}});
                 }
-                pc = r.pc;
-                break;
             }
-            default:
-                eprintf("Error: %s is not an applicable type\n", type_name(op->type));
-                exit(1);
+            pc = enter_lambda(new_pc);
+            break;
+        }
+        case TYPE_HIGH_PRIM: {
+            VM_STAT(vm_stats.high_prim_calls++);
+            High_prim_return r = op->high_prim_data(op + 1, insts[pc].num);
+            if (r.global_env != NULL && r.global_env != global_env) {
+                stack_push((Val){TYPE_GLOBAL_ENV, {.global_env_data = global_env}});
+                global_env = r.global_env;
             }
+            pc = r.pc;
             break;
         }
+        default:
+            eprintf("Error: %s is not an applicable type\n", type_name(op->type));
+            exit(1);
+        }
+        NEXT;
+    }
 
-        case INST_RETURN: {
-            Val result = stack_pop();
+    CASE(INST_RETURN): {
+    do_return:;
+        Val result = stack_pop();
+        if (stack_ptr == stack)
+            return result;
+        Val v = stack_pop();
+        if (v.type == TYPE_GLOBAL_ENV) {
+            global_env = v.global_env_data;
             if (stack_ptr == stack)
                 return result;
-            Val v = stack_pop();
-            if (v.type == TYPE_GLOBAL_ENV) {
-                global_env = v.global_env_data;
-                if (stack_ptr == stack)
-                    return result;
-                v = stack_pop();
-            }
-            pc = v.inst_data;
-            exec_env = stack_pop().env_data;
-            stack_push(result);
-            break;
+            v = stack_pop();
         }
+        pc = v.inst_data;
+        exec_env = stack_pop().env_data;
+        if (v.type == TYPE_FRAME_INST)
+            stack_ptr -= v.frame_size + 1;
+        stack_push(result);
+        NEXT;
+    }
 
-        case INST_DELETE:
-            stack_pop();
-            pc++;
-            break;
+    CASE(INST_DELETE):
+        stack_pop();
+        pc++;
+        NEXT;
 
-        case INST_CONS: {
-            Pair *pair = gc_alloc(sizeof(Pair));
-            pair->cdr = stack_pop();
-            pair->car = stack_pop();
-            stack_push((Val){TYPE_PAIR, {.pair_data = pair}});
-            pc++;
-            break;
-        }
+    CASE(INST_CONS): {
+        PROFILE_ALLOC;
+        Pair *pair = gc_alloc(TYPE_PAIR, sizeof(Pair));
+        pair->cdr = stack_pop();
+        pair->car = stack_pop();
+        stack_push((Val){TYPE_PAIR, {.pair_data = pair}});
+        pc++;
+        NEXT;
+    }
 
-        case INST_EXPR:
-            pc++;
-            break;
+    CASE(INST_EXPR):
+        pc++;
+        NEXT;
 
-        default:
-            eprintf("Error: unrecognized instruction type %d\n", insts[pc].type);
-            exit(1);
+    CASE(INST_ADD): {
+        INLINE_GUARD(add_binding, add_prim);
+        Val *args = stack_ptr - 2;
+        if (args[0].type == TYPE_INT && args[1].type == TYPE_INT)
+            args[0].int_data += args[1].int_data;
+        else
+            args[0] = add_prim(args, 2);
+        stack_ptr--;
+        pc++;
+        NEXT;
+    }
 
-        }
+    CASE(INST_SUB): {
+        INLINE_GUARD(sub_binding, sub_prim);
+        Val *args = stack_ptr - 2;
+        if (args[0].type == TYPE_INT && args[1].type == TYPE_INT)
+            args[0].int_data -= args[1].int_data;
+        else
+            args[0] = sub_prim(args, 2);
+        stack_ptr--;
+        pc++;
+        NEXT;
+    }
+
+    CASE(INST_LT): {
+        INLINE_GUARD(lt_binding, lt_prim);
+        Val *args = stack_ptr - 2;
+        if (args[0].type == TYPE_INT && args[1].type == TYPE_INT)
+            args[0] = (Val){TYPE_BOOL, {.int_data = args[0].int_data < args[1].int_data}};
+        else
+            args[0] = lt_prim(args, 2);
+        stack_ptr--;
+        pc++;
+        NEXT;
+    }
+
+    CASE(INST_NUM_EQ): {
+        INLINE_GUARD(num_eq_binding, equ_prim);
+        Val *args = stack_ptr - 2;
+        if (args[0].type == TYPE_INT && args[1].type == TYPE_INT)
+            args[0] = (Val){TYPE_BOOL, {.int_data = args[0].int_data == args[1].int_data}};
+        else
+            args[0] = equ_prim(args, 2);
+        stack_ptr--;
+        pc++;
+        NEXT;
+    }
+
+    CASE(INST_VAR_0):
+        VM_STAT(count_frame_depth(0));
+        stack_push(exec_env->vals[insts[pc++].var.index]);
+        check_defined(stack_ptr[-1]);
+        NEXT;
+
+    CASE(INST_VAR_1):
+        VM_STAT(count_frame_depth(1));
+        stack_push(exec_env->outer->vals[insts[pc++].var.index]);
+        check_defined(stack_ptr[-1]);
+        NEXT;
+
+    CASE(INST_GLOBAL):
+        VM_STAT(count_frame_depth(UINT32_MAX));
+        stack_push(global_env->bindings[insts[pc++].var.index].val);
+        check_defined(stack_ptr[-1]);
+        NEXT;
+
+    CASE(INST_SET_0): {
+        Val *slot = &exec_env->vals[insts[pc++].var.index];
+        *slot = stack_pop();
+        gc_write_barrier(slot);
+        stack_push((Val){TYPE_VOID});
+        NEXT;
+    }
+
+    CASE(INST_SET_1): {
+        Val *slot = &exec_env->outer->vals[insts[pc++].var.index];
+        *slot = stack_pop();
+        gc_write_barrier(slot);
+        stack_push((Val){TYPE_VOID});
+        NEXT;
+    }
+
+    CASE(INST_SET_GLOBAL): {
+        uint32_t index = insts[pc++].var.index;
+        global_env->bindings[index].val = stack_pop();
+        gc_global_write_barrier(global_env, index);
+        stack_push((Val){TYPE_VOID});
+        NEXT;
+    }
+
+    CASE(INST_VAR_CALL):
+        stack_push(locate_var(insts[pc++].var, exec_env, global_env));
+        check_defined(stack_ptr[-1]);
+        goto do_call;
+
+    CASE(INST_CALL_GLOBAL):
+        VM_STAT(count_frame_depth(UINT32_MAX));
+        stack_push(global_env->bindings[insts[pc++].var.index].val);
+        check_defined(stack_ptr[-1]);
+        goto do_call;
+
+    CASE(INST_VAR_JUMP_FALSE): {
+        Val v = locate_var(insts[pc].var, exec_env, global_env);
+        check_defined(v);
+        if (v.type == TYPE_BOOL && v.int_data == 0)
+            pc = insts[pc + 1].index;
+        else
+            pc += 2;
+        NEXT;
     }
+
+    CASE(INST_CONST_CALL):
+        stack_push(consts[insts[pc++].index]);
+        goto do_call;
+
+    CASE(INST_CONST_RETURN):
+        stack_push(consts[insts[pc].index]);
+        goto do_return;
+
+    CASE(INST_LAZY):
+        load_lazy_lambda(pc);
+        NEXT;
+
+#ifdef NATIVE_CODE
+    CASE(INST_JIT):
+        pc = jit_resumes[insts[pc].index]();
+        NEXT;
+#endif
+
+    DEFAULT:
+        eprintf("Error: unrecognized instruction type %d\n", insts[pc].type);
+        exit(1);
+
+    DISPATCH_END
 }
@@ -2,9 +2,14 @@
 
 /* == exec_gc.h
  * This header file exposes some internal variables of the stack machine.
- * It is only included in the garbage collector, which requires access to such details.
+ * It is only included in the garbage collector and the JIT compiler,
+ * which require access to such details.
  */
 
+#ifndef STACK_SIZE
+#define STACK_SIZE 65536
+#endif
+
 extern Val stack[];
 Val *stack_ptr;
 Global_env *global_env;
@@ -0,0 +1,702 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "image.h"
+#include "cache.h"
+#include "display.h"
+#include "env.h"
+#include "exec_gc.h"
+#include "insts.h"
+#include "memory.h"
+#include "primitives.h"
+#include "safestd.h"
+#include "string.h"
+#include "types.h"
+
+/* == image.c
+ * An image is saved by --save-image once the input files have been run, and
+ * holds everything they and the compiler have added to the interpreter:
+ * the instructions from `compiler_pc` on, the constants added after the ones
+ * created by setup_insts(), the bindings of both global environments, and
+ * the strings and objects reachable from them. --image loads it in place
+ * of compiler.sss, without running anything.
+ *
+ * The image is made to be mapped into memory with mmap and read in place.
+ * It consists of fixed-size records, each a multiple of 8 bytes, in the byte
+ * order of the machine, and is only valid for the build which saved it.
+ * Values refer to strings, objects and primitives by their index in the image,
+ * and instructions to other instructions and constants relative to the first
+ * of the image, so it is relocated when loaded. The obarray is rebuilt
+ * by interning the strings of the image.
+ *
+ * The objects of the heap are allocated before any of them is initialized,
+ * so that they can refer to each other in any way. Until then, they are held
+ * by a vector on the stack, so that the garbage collector finds them.
+ * The only pointers between objects which aren't values, and so aren't covered
+ * by the write barrier, are the environments of lambdas and environments.
+ * These are allocated first, outer environments before inner ones, so that
+ * none of them is in an older generation than an object pointing to it.
+ */
+
+#define IMAGE_MAGIC "sssimg3"
+
+typedef struct Image_header {
+    char magic[8];
+    uint32_t val_size;
+    uint32_t prims_num;
+    uint32_t consts_base;
+    uint32_t consts_num;
+    uint32_t insts_num;
+    uint32_t compile_pc;
+    uint32_t strings_num;
+    uint32_t objects_num;
+    uint32_t bindings_num[2];
+    uint64_t compiler_hash;
+} Image_header;
+
+/* -- Image_val
+ * A value in an image. `data` holds the data of a number, boolean or
+ * character, and the index of the string, object or primitive otherwise.
+ */
+typedef struct Image_val {
+    uint32_t type;
+    uint32_t padding;
+    uint64_t data;
+} Image_val;
+
+/* -- Image_string
+ * A string which is not allocated in the heap. It is followed by `len`
+ * characters, padded to 8 bytes.
+ */
+typedef struct Image_string {
+    uint32_t interned;
+    uint32_t padding;
+    uint64_t len;
+} Image_string;
+
+/* -- Image_object
+ * An object in the heap, or a constant pair or vector. It is followed by the
+ * `len` values of a pair, vector or environment, or the characters of a string,
+ * padded to 8 bytes. `params` and `body` belong to a lambda, with `body`
+ * relative to `compiler_pc`. `outer` is the index of the environment of
+ * a lambda or the outer environment of an environment, or UINT32_MAX for
+ * the global environment.
+ */
+typedef struct Image_object {
+    uint32_t type;
+    uint32_t params;
+    uint32_t body;
+    uint32_t outer;
+    uint64_t len;
+} Image_object;
+
+typedef struct Image_binding {
+    uint64_t name;
+    Image_val val;
+} Image_binding;
+
+static size_t chars_size(size_t len) {
+    return (len * sizeof(char32_t) + 7) / 8 * 8;
+}
+
+static uint32_t prims_num(void) {
+    return r5rs_bindings_size + compiler_bindings_size;
+}
+
+static Val prim_val(uint32_t index) {
+    return index < r5rs_bindings_size ? r5rs_bindings[index].val : compiler_bindings[index - r5rs_bindings_size].val;
+}
+
+/* -- Saving
+ * `indices` maps the addresses of the strings and objects found so far
+ * to their indices, which are given in the order they are found.
+ */
+
+typedef struct Index_entry {
+    void *ptr;
+    uint32_t index;
+} Index_entry;
+
+static Index_entry *indices;
+static size_t indices_size = 1024;
+static size_t indices_num = 0;
+
+static String **strings;
+static uint8_t *interned;
+static uint32_t strings_num;
+static uint32_t strings_size;
+
+static Val *objects;
+static uint32_t objects_num;
+static uint32_t objects_size;
+
+static Index_entry *find_index(void *ptr) {
+    size_t mask = indices_size - 1;
+    for (size_t i = (size_t)(((uint64_t)(uintptr_t)ptr * 0x9E3779B97F4A7C15) >> 32) & mask; ; i = (i + 1) & mask)
+        if (indices[i].ptr == ptr || indices[i].ptr == NULL)
+            return &indices[i];
+}
+
+static void add_index(void *ptr, uint32_t index) {
+    if (2 * (indices_num + 1) > indices_size) {
+        Index_entry *old = indices;
+        size_t old_size = indices_size;
+        indices_size *= 2;
+        indices = s_malloc(indices_size * sizeof(Index_entry));
+        memset(indices, 0, indices_size * sizeof(Index_entry));
+        for (size_t i = 0; i < old_size; i++)
+            if (old[i].ptr != NULL)
+                *find_index(old[i].ptr) = old[i];
+        free(old);
+    }
+    *find_index(ptr) = (Index_entry){ptr, index};
+    indices_num++;
+}
+
+static uint32_t string_index(String *str, int is_interned) {
+    Index_entry *entry = find_index(str);
+    if (entry->ptr != NULL)
+        return entry->index;
+    if (strings_num == strings_size) {
+        strings_size = strings_size ? 2 * strings_size : 256;
+        strings = s_realloc(strings, strings_size * sizeof(String *));
+        interned = s_realloc(interned, strings_size);
+    }
+    strings[strings_num] = str;
+    interned[strings_num] = (uint8_t)is_interned;
+    add_index(str, strings_num);
+    return strings_num++;
+}
+
+// the data of all objects is a pointer at the same place
+static void *object_ptr(Val val) {
+    return val.pair_data;
+}
+
+static uint32_t object_index(Val val) {
+    Index_entry *entry = find_index(object_ptr(val));
+    if (entry->ptr != NULL)
+        return entry->index;
+    if (objects_num == objects_size) {
+        objects_size = objects_size ? 2 * objects_size : 256;
+        objects = s_realloc(objects, objects_size * sizeof(Val));
+    }
+    objects[objects_num] = val;
+    add_index(object_ptr(val), objects_num);
+    return objects_num++;
+}
+
+static uint32_t env_index(Env *env) {
+    if (env == NULL)
+        return UINT32_MAX;
+    Index_entry *entry = find_index(env);
+    if (entry->ptr != NULL)
+        return entry->index;
+    env_index(env->outer);
+    return object_index((Val){TYPE_ENV, {.env_data = env}});
+}
+
+static uint32_t prim_index(Val val) {
+    for (uint32_t i = 0; i < prims_num(); i++) {
+        Val prim = prim_val(i);
+        if (prim.type == val.type && (val.type == TYPE_PRIM ? prim.prim_data == val.prim_data
+                                                             : prim.high_prim_data == val.high_prim_data))
+            return i;
+    }
+    eprintf("Error: primitive not found in the image\n");
+    exit(1);
+}
+
+/* -- image_val
+ * Returns the representation of a value in the image, adding the string
+ * or object it refers to if it hasn't been found yet.
+ */
+static Image_val image_val(Val val) {
+    Image_val v = {(uint32_t)val.type, 0, 0};
+    switch (val.type) {
+    case TYPE_INT:
+    case TYPE_BOOL:
+        v.data = (uint64_t)val.int_data;
+        break;
+    case TYPE_FLOAT:
+        memcpy(&v.data, &val.float_data, sizeof(double));
+        break;
+    case TYPE_CHAR:
+        v.data = val.char_data;
+        break;
+    case TYPE_CONST_STRING:
+    case TYPE_SYMBOL:
+        v.data = string_index(val.string_data, val.type == TYPE_SYMBOL);
+        break;
+    case TYPE_PRIM:
+    case TYPE_HIGH_PRIM:
+        v.data = prim_index(val);
+        break;
+    case TYPE_STRING:
+    case TYPE_LAMBDA:
+    case TYPE_PAIR:
+    case TYPE_CONST_PAIR:
+    case TYPE_VECTOR:
+    case TYPE_CONST_VECTOR:
+        v.data = object_index(val);
+        break;
+    case TYPE_NIL:
+    case TYPE_VOID:
+    case TYPE_UNDEF:
+        break;
+    default:
+        eprintf("Error: value of type %s can't be saved in an image\n", type_name(val.type));
+        exit(1);
+    }
+    return v;
+}
+
+static void write_data(FILE *fp, const void *data, size_t size) {
+    if (size > 0 && fwrite(data, size, 1, fp) != 1) {
+        eprintf("Error: could not write the image\n");
+        exit(1);
+    }
+}
+
+static void write_val(FILE *fp, Val val) {
+    Image_val v = image_val(val);
+    write_data(fp, &v, sizeof(Image_val));
+}
+
+static void write_chars(FILE *fp, String *str) {
+    static const char padding[8];
+    write_data(fp, str->chars, str->len * sizeof(char32_t));
+    write_data(fp, padding, chars_size(str->len) - str->len * sizeof(char32_t));
+}
+
+/* -- write_object
+ * Writes the object with the given index, or, if `fp` is NULL, only adds
+ * the strings and objects it refers to.
+ */
+static void write_object(FILE *fp, uint32_t index) {
+    Val val = objects[index];
+    Image_object object = {(uint32_t)val.type, 0, 0, UINT32_MAX, 0};
+    Val *vals = NULL;
+    switch (val.type) {
+    case TYPE_PAIR:
+    case TYPE_CONST_PAIR:
+        object.len = 2;
+        vals = &val.pair_data->car;
+        break;
+    case TYPE_VECTOR:
+    case TYPE_CONST_VECTOR:
+        object.len = val.vector_data->len;
+        vals = val.vector_data->vals;
+        break;
+    case TYPE_STRING:
+        object.len = val.string_data->len;
+        break;
+    case TYPE_LAMBDA:
+        if (val.lambda_data->body < compiler_pc) {
+            eprintf("Error: lambda outside of the image\n");
+            exit(1);
+        }
+        object.params = val.lambda_data->params;
+        object.body = val.lambda_data->body - compiler_pc;
+        object.outer = env_index(val.lambda_data->env);
+        break;
+    case TYPE_ENV:
+        object.len = val.env_data->size;
+        object.outer = env_index(val.env_data->outer);
+        vals = val.env_data->vals;
+        break;
+    default:
+        break;
+    }
+    if (fp == NULL) {
+        for (size_t i = 0; vals != NULL && i < object.len; i++)
+            image_val(vals[i]);
+        return;
+    }
+    write_data(fp, &object, sizeof(Image_object));
+    if (val.type == TYPE_STRING)
+        write_chars(fp, val.string_data);
+    for (size_t i = 0; vals != NULL && i < object.len; i++)
+        write_val(fp, vals[i]);
+}
+
+/* -- image_inst
+ * Returns an instruction with its operands made relative to the image.
+ */
+static Inst image_inst(Inst inst, uint32_t insts_base, uint32_t consts_base) {
+    switch (generic_type(inst.type)) {
+    case INST_CONST:
+    case INST_NAME:
+    case INST_DEF:
+    case INST_SET_NAME:
+        inst.index -= consts_base;
+        break;
+    case INST_JUMP:
+    case INST_JUMP_FALSE:
+        inst.index -= insts_base;
+        break;
+    case INST_LAMBDA:
+        inst.lambda.index -= insts_base;
+        break;
+    default:
+        break;
+    }
+    return inst;
+}
+
+/* -- save_image
+ * Saves the image of the current state of the interpreter. It may only
+ * be called between top-level expressions.
+ */
+void save_image(FILE *fp) {
+    load_lazy_lambdas(compiler_pc, this_inst());
+    Global_env *envs[2] = {execution_env, compiler_env};
+    uint32_t end_const = this_const();
+    uint32_t end_inst = this_inst();
+    indices = s_malloc(indices_size * sizeof(Index_entry));
+    memset(indices, 0, indices_size * sizeof(Index_entry));
+
+    // find all strings and objects first, since the image starts with them
+    for (uint32_t i = compiler_consts; i < end_const; i++)
+        image_val(consts[i]);
+    for (int k = 0; k < 2; k++) {
+        for (uint32_t i = 0; i < envs[k]->size; i++) {
+            string_index(envs[k]->bindings[i].var, 1);
+            image_val(envs[k]->bindings[i].val);
+        }
+    }
+    for (uint32_t i = 0; i < objects_num; i++)
+        write_object(NULL, i);
+
+    Image_header header = {IMAGE_MAGIC, sizeof(Val), prims_num(), compiler_consts, end_const - compiler_consts,
+        end_inst - compiler_pc, compile_pc - compiler_pc, strings_num, objects_num,
+        {execution_env->size, compiler_env->size}, get_compiler_hash()};
+    write_data(fp, &header, sizeof(Image_header));
+    for (uint32_t i = 0; i < strings_num; i++) {
+        Image_string string = {interned[i], 0, strings[i]->len};
+        write_data(fp, &string, sizeof(Image_string));
+        write_chars(fp, strings[i]);
+    }
+    for (uint32_t i = 0; i < objects_num; i++)
+        write_object(fp, i);
+    for (uint32_t i = compiler_consts; i < end_const; i++)
+        write_val(fp, consts[i]);
+    for (uint32_t i = compiler_pc; i < end_inst; i++) {
+        Inst inst = image_inst(insts[i], compiler_pc, compiler_consts);
+        write_data(fp, &inst, sizeof(Inst));
+    }
+    for (int k = 0; k < 2; k++) {
+        for (uint32_t i = 0; i < envs[k]->size; i++) {
+            Image_binding binding = {string_index(envs[k]->bindings[i].var, 1), image_val(envs[k]->bindings[i].val)};
+            write_data(fp, &binding, sizeof(Image_binding));
+        }
+    }
+    if (fclose(fp) != 0) {
+        eprintf("Error: could not write the image\n");
+        exit(1);
+    }
+}
+
+/* -- Loading
+ * The image is read from `image_ptr` up to `image_end`.
+ */
+
+static const char *image_ptr;
+static const char *image_end;
+
+static void invalid_image(void) {
+    eprintf("Error: invalid image\n");
+    exit(1);
+}
+
+static const void *take(size_t size) {
+    if ((size_t)(image_end - image_ptr) < size)
+        invalid_image();
+    const char *p = image_ptr;
+    image_ptr += size;
+    return p;
+}
+
+static String **loaded_strings;
+static const Image_header *loaded_header;
+
+// the vector holding the objects, which is on top of the stack
+static Vector *loaded_objects(void) {
+    return stack_ptr[-1].vector_data;
+}
+
+static Val load_val(const Image_val *v) {
+    Val val = {(Type)v->type};
+    switch (val.type) {
+    case TYPE_INT:
+    case TYPE_BOOL:
+        val.int_data = (long long)v->data;
+        return val;
+    case TYPE_FLOAT:
+        memcpy(&val.float_data, &v->data, sizeof(double));
+        return val;
+    case TYPE_CHAR:
+        val.char_data = (char32_t)v->data;
+        return val;
+    case TYPE_CONST_STRING:
+    case TYPE_SYMBOL:
+        if (v->data >= loaded_header->strings_num)
+            invalid_image();
+        val.string_data = loaded_strings[v->data];
+        return val;
+    case TYPE_PRIM:
+    case TYPE_HIGH_PRIM:
+        if (v->data >= prims_num() || prim_val((uint32_t)v->data).type != val.type)
+            invalid_image();
+        return prim_val((uint32_t)v->data);
+    case TYPE_STRING:
+    case TYPE_LAMBDA:
+    case TYPE_PAIR:
+    case TYPE_CONST_PAIR:
+    case TYPE_VECTOR:
+    case TYPE_CONST_VECTOR:
+        if (v->data >= loaded_header->objects_num || loaded_objects()->vals[v->data].type != val.type)
+            invalid_image();
+        return loaded_objects()->vals[v->data];
+    case TYPE_NIL:
+    case TYPE_VOID:
+    case TYPE_UNDEF:
+        return val;
+    default:
+        invalid_image();
+        return val;
+    }
+}
+
+static Env *load_env(uint32_t index) {
+    if (index == UINT32_MAX)
+        return NULL;
+    if (index >= loaded_header->objects_num || loaded_objects()->vals[index].type != TYPE_ENV)
+        invalid_image();
+    return loaded_objects()->vals[index].env_data;
+}
+
+static void init_vals(Val *vals, size_t len) {
+    for (size_t i = 0; i < len; i++)
+        vals[i] = (Val){TYPE_NIL};
+}
+
+/* -- alloc_object
+ * Allocates the object of a record, leaving the values in it empty.
+ */
+static void alloc_object(uint32_t index, const Image_object *object, uint32_t insts_base) {
+    Val val = {(Type)object->type};
+    switch (val.type) {
+    case TYPE_ENV:
+        if (object->len >= UINT32_MAX)
+            invalid_image();
+        val.env_data = gc_alloc(TYPE_ENV, sizeof(Env) + object->len * sizeof(Val));
+        val.env_data->size = (uint32_t)object->len;
+        val.env_data->outer = NULL;
+        init_vals(val.env_data->vals, object->len);
+        break;
+    case TYPE_LAMBDA:
+        val.lambda_data = gc_alloc(TYPE_LAMBDA, sizeof(Lambda));
+        val.lambda_data->params = object->params;
+        val.lambda_data->body = insts_base + object->body;
+        val.lambda_data->env = NULL;
+        break;
+    case TYPE_PAIR:
+        val.pair_data = gc_alloc(TYPE_PAIR, sizeof(Pair));
+        init_vals(&val.pair_data->car, 2);
+        break;
+    case TYPE_CONST_PAIR:
+        val.pair_data = s_malloc(sizeof(Pair));
+        init_vals(&val.pair_data->car, 2);
+        break;
+    case TYPE_VECTOR:
+        // a vector in the heap holds at least one value
+        val.vector_data = gc_alloc(TYPE_VECTOR, sizeof(Vector) + (object->len ? object->len : 1) * sizeof(Val));
+        val.vector_data->len = object->len;
+        init_vals(val.vector_data->vals, object->len ? object->len : 1);
+        break;
+    case TYPE_CONST_VECTOR:
+        val.vector_data = s_malloc(sizeof(Vector) + object->len * sizeof(Val));
+        val.vector_data->len = object->len;
+        init_vals(val.vector_data->vals, object->len);
+        break;
+    case TYPE_STRING:
+        val.string_data = gc_alloc_string(object->len);
+        memcpy(val.string_data->chars, object + 1, object->len * sizeof(char32_t));
+        break;
+    default:
+        invalid_image();
+    }
+    Val *slot = &loaded_objects()->vals[index];
+    *slot = val;
+    gc_write_barrier(slot);
+}
+
+/* -- init_object
+ * Sets the values in an object and its environment.
+ */
+static void init_object(uint32_t index, const Image_object *object) {
+    Val val = loaded_objects()->vals[index];
+    const Image_val *v = (const Image_val *)(object + 1);
+    Val *vals;
+    switch (val.type) {
+    case TYPE_ENV:
+        val.env_data->outer = load_env(object->outer);
+        vals = val.env_data->vals;
+        break;
+    case TYPE_LAMBDA:
+        val.lambda_data->env = load_env(object->outer);
+        return;
+    case TYPE_PAIR:
+    case TYPE_CONST_PAIR:
+        if (object->len != 2)
+            invalid_image();
+        vals = &val.pair_data->car;
+        break;
+    case TYPE_VECTOR:
+    case TYPE_CONST_VECTOR:
+        vals = val.vector_data->vals;
+        break;
+    default:
+        return;
+    }
+    for (size_t i = 0; i < object->len; i++) {
+        vals[i] = load_val(&v[i]);
+        gc_write_barrier(&vals[i]);
+    }
+}
+
+static Inst load_inst(Inst inst, uint32_t insts_base, uint32_t consts_base) {
+    switch (generic_type(inst.type)) {
+    case INST_CONST:
+    case INST_NAME:
+    case INST_DEF:
+    case INST_SET_NAME:
+        inst.index += consts_base;
+        break;
+    case INST_JUMP:
+    case INST_JUMP_FALSE:
+        inst.index += insts_base;
+        break;
+    case INST_LAMBDA:
+        inst.lambda.index += insts_base;
+        break;
+    default:
+        break;
+    }
+    return inst;
+}
+
+/* -- load_image
+ * Loads an image saved by the same build of the interpreter,
+ * right after setup_insts().
+ */
+void load_image(const char *file_name) {
+    int fd = open(file_name, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        eprintf("Error: could not open file %s\n", file_name);
+        exit(1);
+    }
+    size_t size = (size_t)st.st_size;
+    char *data = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED)
+        invalid_image();
+    image_ptr = data;
+    image_end = data + size;
+
+    const Image_header *header = loaded_header = take(sizeof(Image_header));
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0)
+        invalid_image();
+    if (header->val_size != sizeof(Val) || header->prims_num != prims_num()
+            || header->consts_base != this_const() || header->compile_pc >= header->insts_num) {
+        eprintf("Error: image saved by a different build of the interpreter\n");
+        exit(1);
+    }
+    uint32_t insts_base = this_inst();
+    uint32_t consts_base = this_const();
+    compiler_hash = header->compiler_hash;
+
+    loaded_strings = s_malloc((header->strings_num + 1) * sizeof(String *));
+    for (uint32_t i = 0; i < header->strings_num; i++) {
+        const Image_string *string = take(sizeof(Image_string));
+        if (string->len > size)
+            invalid_image();
+        char32_t *chars = (char32_t *)take(chars_size(string->len));
+        if (string->interned) {
+            loaded_strings[i] = new_interned_string(string->len, chars);
+        } else {
+            loaded_strings[i] = s_malloc(sizeof(String) + string->len * sizeof(char32_t));
+            loaded_strings[i]->len = string->len;
+            memcpy(loaded_strings[i]->chars, chars, string->len * sizeof(char32_t));
+        }
+    }
+
+    const Image_object **objects = s_malloc((header->objects_num + 1) * sizeof(Image_object *));
+    for (uint32_t i = 0; i < header->objects_num; i++) {
+        objects[i] = take(sizeof(Image_object));
+        if (objects[i]->len > size)
+            invalid_image();
+        if (objects[i]->type == TYPE_STRING)
+            take(chars_size(objects[i]->len));
+        else if (objects[i]->type != TYPE_LAMBDA)
+            take(objects[i]->len * sizeof(Image_val));
+        if (objects[i]->type == TYPE_LAMBDA && objects[i]->body >= header->insts_num)
+            invalid_image();
+    }
+    Vector *vec = gc_alloc(TYPE_VECTOR, sizeof(Vector) + (header->objects_num + 1) * sizeof(Val));
+    vec->len = header->objects_num;
+    init_vals(vec->vals, header->objects_num + 1);
+    *stack_ptr++ = (Val){TYPE_VECTOR, {.vector_data = vec}};
+    for (uint32_t i = 0; i < header->objects_num; i++)
+        if (objects[i]->type == TYPE_ENV)
+            alloc_object(i, objects[i], insts_base);
+    for (uint32_t i = 0; i < header->objects_num; i++)
+        if (objects[i]->type != TYPE_ENV)
+            alloc_object(i, objects[i], insts_base);
+    // nothing is allocated in the heap from here on
+    for (uint32_t i = 0; i < header->objects_num; i++)
+        init_object(i, objects[i]);
+    free(objects);
+
+    const Image_val *vals = take(header->consts_num * sizeof(Image_val));
+    for (uint32_t i = 0; i < header->consts_num; i++)
+        new_const(load_val(&vals[i]));
+    const Inst *image_insts = take(header->insts_num * sizeof(Inst));
+    for (uint32_t i = 0; i < header->insts_num; i++) {
+        uint32_t n = next_inst();
+        insts[n] = load_inst(image_insts[i], insts_base, consts_base);
+    }
+    compile_pc = insts_base + header->compile_pc;
+
+    Global_env *envs[2] = {execution_env, compiler_env};
+    for (int k = 0; k < 2; k++) {
+        const Image_binding *bindings = take(header->bindings_num[k] * sizeof(Image_binding));
+        for (uint32_t i = 0; i < header->bindings_num[k]; i++) {
+            if (bindings[i].name >= header->strings_num)
+                invalid_image();
+            String *name = loaded_strings[bindings[i].name];
+            Val val = load_val(&bindings[i].val);
+            if (i < envs[k]->size) {
+                if (envs[k]->bindings[i].var != name)
+                    invalid_image();
+                envs[k]->bindings[i].val = val;
+                gc_global_write_barrier(envs[k], i);
+            } else {
+                define_var(name, val, envs[k]);
+                if (envs[k]->size != i + 1)
+                    invalid_image();
+            }
+        }
+    }
+    stack_ptr--;
+    free(loaded_strings);
+    munmap(data, size);
+}
@@ -0,0 +1,11 @@
+#include <stdio.h>
+
+#include "types.h"
+
+/* == image.h
+ * An image holds the state of the interpreter after the compiler has been
+ * set up, so that loading it replaces loading compiler.sss and running it.
+ */
+
+void save_image(FILE *fp);
+void load_image(const char *file_name);
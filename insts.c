@@ -1,6 +1,8 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #if defined(__linux__) && !LOAD_FROM_CURRENT_DIR
 #include <limits.h>
@@ -9,13 +11,27 @@
 #include "insts.h"
 #include "types.h"
 #include "display.h"
+#include "jit.h"
 #include "safestd.h"
 #include "string.h"
 
+// the minimum length of the body of a lambda to be loaded lazily
+#ifndef LAZY_MIN_BODY
+#define LAZY_MIN_BODY 16
+#endif
+
 Inst *insts;
 static uint32_t insts_size = 4096;
 static uint32_t inst_index = 0;
 
+Val *consts;
+static uint32_t consts_size = 1024;
+static uint32_t const_index = 0;
+
+static Source_pos *source_pos_table = NULL;
+static uint32_t source_pos_table_size = 0;
+static uint32_t source_pos_index = 0;
+
 static char *get_path(void) {
 #if defined(__linux__) && !LOAD_FROM_CURRENT_DIR
     char *path = realpath("/proc/self/exe", NULL);
@@ -46,27 +62,46 @@ High_prim for_each_prim_continuation;
 
 void setup_insts(void) {
     insts = s_malloc(insts_size * sizeof(Inst));
+    consts = s_malloc(consts_size * sizeof(Val));
     return_inst = next_inst();
     insts[return_inst] = (Inst){INST_RETURN};
     tail_call_inst = next_inst();
     insts[tail_call_inst] = (Inst){INST_TAIL_CALL};
     map_continue_inst = next_inst();
     insts[map_continue_inst] = (Inst){INST_CALL};
-    insts[next_inst()] = (Inst){INST_CONST, {.val = (Val){TYPE_HIGH_PRIM, {.high_prim_data = map_prim_continuation}}}};
+    insts[next_inst()] = (Inst){INST_CONST, {.index = new_const((Val){TYPE_HIGH_PRIM, {.high_prim_data = map_prim_continuation}})}};
     insts[next_inst()] = (Inst){INST_TAIL_CALL, {.num = 0}};
     for_each_continue_inst = next_inst();
     insts[for_each_continue_inst] = (Inst){INST_CALL};
-    insts[next_inst()] = (Inst){INST_CONST, {.val = (Val){TYPE_HIGH_PRIM, {.high_prim_data = for_each_prim_continuation}}}};
+    insts[next_inst()] = (Inst){INST_CONST, {.index = new_const((Val){TYPE_HIGH_PRIM, {.high_prim_data = for_each_prim_continuation}})}};
     insts[next_inst()] = (Inst){INST_TAIL_CALL, {.num = 0}};
+#ifdef NATIVE_CODE
+    setup_jit();
+#endif
     compiler_pc = this_inst();
+    compiler_consts = this_const();
+}
+
+/* -- open_compiler
+ * Opens compiler.sss, which is looked for next to the executable.
+ */
+FILE *open_compiler(void) {
     char *path = get_path();
-    load_insts(fopen_relative(path, "compiler.sss", "rb"));
+    FILE *f = fopen_relative(path, "compiler.sss", "rb");
     free(path);
+    return f;
+}
+
+/* -- load_compiler
+ * Loads the compiler from compiler.sss, starting at `compiler_pc`,
+ * followed by the instructions calling it.
+ */
+void load_compiler(void) {
+    FILE *f = open_compiler();
+    load_insts(f);
+    fclose(f);
     compile_pc = this_inst();
-    insts[next_inst()] = (Inst){INST_NAME, {.name = new_interned_string_from_cstring("parse-and-compile")}};
-    insts[next_inst()] = (Inst){INST_TAIL_CALL, {.num = 0}};
-    parse_pc = this_inst();
-    insts[next_inst()] = (Inst){INST_NAME, {.name = new_interned_string_from_cstring("parse")}};
+    insts[next_inst()] = (Inst){INST_NAME, {.index = new_const((Val){TYPE_SYMBOL, {.string_data = new_interned_string_from_cstring("parse-and-compile")}})}};
     insts[next_inst()] = (Inst){INST_TAIL_CALL, {.num = 0}};
 }
 
@@ -90,6 +125,98 @@ uint32_t this_inst(void) {
     return inst_index;
 }
 
+/* -- this_const
+ * Returns the index of the next constant added to the constant pool.
+ */
+uint32_t this_const(void) {
+    return const_index;
+}
+
+/* -- new_const
+ * Adds a value to the constant pool and returns its index.
+ */
+uint32_t new_const(Val val) {
+    if (const_index >= consts_size) {
+        consts_size *= 2;
+        consts = s_realloc(consts, consts_size * sizeof(Val));
+    }
+    consts[const_index] = val;
+    return const_index++;
+}
+
+/* -- add_source_pos
+ * Adds an entry to the source position table.
+ */
+void add_source_pos(uint32_t inst, const char *file, uint32_t line) {
+    if (source_pos_index >= source_pos_table_size) {
+        source_pos_table_size = source_pos_table_size ? source_pos_table_size * 2 : 64;
+        source_pos_table = s_realloc(source_pos_table, source_pos_table_size * sizeof(Source_pos));
+    }
+    source_pos_table[source_pos_index++] = (Source_pos){inst, line, file};
+}
+
+/* -- find_source_pos
+ * Returns the source position of the code containing a given instruction,
+ * or NULL if it wasn't compiled from a source file.
+ * Code loaded from bytecode has no entries, and lies between the code
+ * of different expressions, so an entry is only valid up to the next
+ * INST_EXPR instruction.
+ */
+const Source_pos *find_source_pos(uint32_t inst) {
+    uint32_t low = 0, high = source_pos_index;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (source_pos_table[mid].inst <= inst)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low == 0)
+        return NULL;
+    const Source_pos *pos = &source_pos_table[low - 1];
+    for (uint32_t i = pos->inst + 1; i <= inst; i++)
+        if (insts[i].type == INST_EXPR || insts[i].type == INST_EOF)
+            return NULL;
+    return pos;
+}
+
+/* -- find_lambdas
+ * Returns an array mapping every instruction to the INST_LAMBDA instruction
+ * of the innermost lambda containing it, or UINT32_MAX if there is none.
+ * The body of a lambda directly precedes its INST_LAMBDA instruction,
+ * so visiting the instructions backwards marks inner lambdas last.
+ */
+uint32_t *find_lambdas(void) {
+    uint32_t *lambdas = s_malloc((inst_index + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i <= inst_index; i++)
+        lambdas[i] = UINT32_MAX;
+    for (uint32_t i = inst_index; i-- > 0; )
+        if (insts[i].type == INST_LAMBDA)
+            for (uint32_t j = insts[i].lambda.index; j < i; j++)
+                lambdas[j] = i;
+    return lambdas;
+}
+
+/* -- print_lambda
+ * Prints a lambda given by its INST_LAMBDA instruction, using the name
+ * it is defined as if it's immediately bound by a definition, followed
+ * by its source position if it is known.
+ */
+void print_lambda(FILE *f, uint32_t lambda) {
+    if (lambda == UINT32_MAX) {
+        fprintf(f, "top level");
+        return;
+    }
+    if (insts[lambda + 1].type == INST_DEF) {
+        fputs32(consts[insts[lambda + 1].index].string_data, f);
+        fprintf(f, " ");
+    }
+    fprintf(f, "lambda at %"PRIu32, lambda);
+    const Source_pos *pos = find_source_pos(lambda);
+    if (pos != NULL)
+        fprintf(f, " (%s:%"PRIu32")", pos->file, pos->line);
+}
+
 /* -- next_expr
  * Finds the beginning of the next expression or end of code starting
  * from the given index.
@@ -100,23 +227,233 @@ uint32_t next_expr(uint32_t start) {
             return i;
 }
 
-static void save_uint32(FILE *fp, uint32_t n) {
-    for (int i = 3; i >= 0; i--)
-        s_fputc((uint8_t)(n >> 8 * i), fp);
+/* -- specialized_type
+ * Returns the type which replaces the instruction at `n`: a superinstruction
+ * if it can be fused with the one following it, otherwise an instruction
+ * specialized for its operand, or its own type if there is none.
+ */
+enum Inst_type specialized_type(uint32_t n) {
+    enum Inst_type next = insts[n + 1].type;
+    switch (insts[n].type) {
+    case INST_VAR:
+        if (next == INST_CALL)
+            return insts[n].var.frame == UINT32_MAX ? INST_CALL_GLOBAL : INST_VAR_CALL;
+        if (next == INST_JUMP_FALSE)
+            return INST_VAR_JUMP_FALSE;
+        switch (insts[n].var.frame) {
+        case 0:
+            return INST_VAR_0;
+        case 1:
+            return INST_VAR_1;
+        case UINT32_MAX:
+            return INST_GLOBAL;
+        default:
+            return INST_VAR;
+        }
+    case INST_SET:
+        switch (insts[n].var.frame) {
+        case 0:
+            return INST_SET_0;
+        case 1:
+            return INST_SET_1;
+        case UINT32_MAX:
+            return INST_SET_GLOBAL;
+        default:
+            return INST_SET;
+        }
+    case INST_CONST:
+        if (next == INST_CALL)
+            return INST_CONST_CALL;
+        if (next == INST_RETURN)
+            return INST_CONST_RETURN;
+        return INST_CONST;
+    default:
+        return insts[n].type;
+    }
+}
+
+/* -- specialize_insts
+ * Replaces the instructions between `start` and `end` with specialized
+ * instructions, and common pairs of them with superinstructions, which
+ * execute both of them with a single dispatch.
+ * Global names are only specialized once INST_NAME or INST_SET_NAME
+ * has located them.
+ */
+void specialize_insts(uint32_t start, uint32_t end) {
+    for (uint32_t n = start; n + 1 < end; n++)
+        insts[n].type = specialized_type(n);
+}
+
+/* -- generic_type
+ * Returns the type of the instruction replaced by a specialized instruction
+ * or superinstruction.
+ */
+enum Inst_type generic_type(enum Inst_type type) {
+    switch (type) {
+    case INST_VAR_0:
+    case INST_VAR_1:
+    case INST_GLOBAL:
+    case INST_VAR_CALL:
+    case INST_CALL_GLOBAL:
+    case INST_VAR_JUMP_FALSE:
+        return INST_VAR;
+    case INST_SET_0:
+    case INST_SET_1:
+    case INST_SET_GLOBAL:
+        return INST_SET;
+    case INST_CONST_CALL:
+    case INST_CONST_RETURN:
+        return INST_CONST;
+    default:
+        return type;
+    }
+}
+
+/* -- Bytecode files
+ * A bytecode file starts with a magic number and a version. Version v5.1
+ * is followed by a header holding the number of strings, constants,
+ * instructions, relocations and lazy lambdas, each as a 4-byte big-endian
+ * integer, and the sections:
+ * - The lambda index, holding the outermost lambdas whose bodies can be
+ *   loaded on their first call (see load_lazy_lambda). Each is written as
+ *   the distance from the end of the previous body to the start of its
+ *   body, the length of its body, and the same two numbers in bytes of
+ *   the instructions section, followed by the number of its constants.
+ * - The string table, holding each distinct string used by a string
+ *   constant or a symbol once, as its length in characters and in bytes,
+ *   followed by its UTF-8 encoding.
+ * - The instructions, each as its type followed by its operands. Integers
+ *   are written as LEB128 varints, signed ones zigzag-encoded, and strings
+ *   and symbols as their index in the string table. Variable frames are
+ *   incremented, so that globals, in frame UINT32_MAX, take one byte.
+ * - The relocations, holding the instructions whose operand is the index of
+ *   an instruction, relative to the first one of the file, each as its
+ *   distance from the previous one. The loader adds the index at which
+ *   the file is loaded to these operands.
+ * Version v5.0 files are the same without the lambda index, and version
+ * v4.1 files, written before, are still read.
+ */
+
+static const char *magic = "\xf0\x9f\x91\xad";
+static const char *version = "v5.1";
+static const char *version_5_0 = "v5.0";
+static const char *version_4 = "v4.1";
+
+/* -- Buffer
+ * A growable byte buffer, in which the sections of a bytecode file are
+ * written before their sizes are known.
+ */
+typedef struct Buffer {
+    unsigned char *data;
+    size_t len;
+    size_t size;
+} Buffer;
+
+static void put_byte(Buffer *buf, unsigned char c) {
+    if (buf->len >= buf->size) {
+        buf->size = buf->size ? buf->size * 2 : 4096;
+        buf->data = s_realloc(buf->data, buf->size);
+    }
+    buf->data[buf->len++] = c;
 }
 
-static void save_string(FILE *fp, String *str) {
-    for (int i = 7; i >= 0; i--)
-        s_fputc((uint8_t)(str->len >> 8 * i), fp);
-    fputs32(str, fp);
+static void put_varint(Buffer *buf, uint64_t n) {
+    while (n >= 0x80) {
+        put_byte(buf, (unsigned char)(n | 0x80));
+        n >>= 7;
+    }
+    put_byte(buf, (unsigned char)n);
+}
+
+static void put_utf8(Buffer *buf, char32_t c) {
+    if (c < 0x80) {
+        put_byte(buf, (unsigned char)c);
+    } else if (c < 0x800) {
+        put_byte(buf, (unsigned char)(0xC0 | c >> 6));
+        put_byte(buf, (unsigned char)(0x80 | (c & 0x3F)));
+    } else if (c < 0x10000) {
+        put_byte(buf, (unsigned char)(0xE0 | c >> 12));
+        put_byte(buf, (unsigned char)(0x80 | (c >> 6 & 0x3F)));
+        put_byte(buf, (unsigned char)(0x80 | (c & 0x3F)));
+    } else {
+        put_byte(buf, (unsigned char)(0xF0 | c >> 18));
+        put_byte(buf, (unsigned char)(0x80 | (c >> 12 & 0x3F)));
+        put_byte(buf, (unsigned char)(0x80 | (c >> 6 & 0x3F)));
+        put_byte(buf, (unsigned char)(0x80 | (c & 0x3F)));
+    }
+}
+
+/* -- String_table
+ * The string table of a bytecode file being written, with a hash table
+ * mapping the contents of each string to its index plus one.
+ */
+typedef struct String_table {
+    Buffer buf;
+    uint32_t num;
+    String **strings;
+    uint32_t *slots;
+    uint32_t slots_size;
+} String_table;
+
+static uint32_t hash_string(String *str) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < str->len; i++)
+        hash = (hash ^ (uint32_t)str->chars[i]) * 16777619u;
+    return hash;
 }
 
-static void save_val(FILE *fp, Val val) {
-    s_fputc((int)val.type, fp);
+static uint32_t *find_slot(String_table *table, String *str) {
+    uint32_t mask = table->slots_size - 1;
+    for (uint32_t i = hash_string(str) & mask; ; i = (i + 1) & mask)
+        if (table->slots[i] == 0 || string_eq(table->strings[table->slots[i] - 1], str))
+            return &table->slots[i];
+}
+
+/* -- string_index
+ * Returns the index of a string in the table, adding it if it's not there.
+ */
+static uint32_t string_index(String_table *table, String *str) {
+    uint32_t *slot = find_slot(table, str);
+    if (*slot != 0)
+        return *slot - 1;
+    if (2 * (table->num + 1) > table->slots_size) {
+        uint32_t *old_slots = table->slots;
+        uint32_t old_size = table->slots_size;
+        table->slots_size *= 2;
+        table->slots = calloc(table->slots_size, sizeof(uint32_t));
+        if (table->slots == NULL) {
+            eprintf("Error: out of memory\n");
+            exit(1);
+        }
+        for (uint32_t i = 0; i < old_size; i++)
+            if (old_slots[i] != 0)
+                *find_slot(table, table->strings[old_slots[i] - 1]) = old_slots[i];
+        free(old_slots);
+        slot = find_slot(table, str);
+    }
+    table->strings = s_realloc(table->strings, (table->num + 1) * sizeof(String *));
+    table->strings[table->num] = str;
+    *slot = ++table->num;
+
+    size_t size = 0;
+    for (size_t i = 0; i < str->len; i++)
+        size += str->chars[i] < 0x80 ? 1 : str->chars[i] < 0x800 ? 2 : str->chars[i] < 0x10000 ? 3 : 4;
+    put_varint(&table->buf, str->len);
+    put_varint(&table->buf, size);
+    for (size_t i = 0; i < str->len; i++)
+        put_utf8(&table->buf, str->chars[i]);
+    return table->num - 1;
+}
+
+/* -- save_val
+ * Writes a constant. Returns 0 if it can't be written, storing the value
+ * which can't in `invalid`.
+ */
+static int save_val(Buffer *buf, String_table *strings, Val val, Val *invalid) {
+    put_byte(buf, (unsigned char)val.type);
     switch (val.type) {
     case TYPE_INT:
-        for (int i = 7; i >= 0; i--)
-            s_fputc((uint8_t)((uint64_t)val.int_data >> 8 * i), fp);
+        put_varint(buf, (uint64_t)val.int_data << 1 ^ (uint64_t)(val.int_data >> 63));
         break;
     case TYPE_FLOAT: {
         uint64_t n = (union {
@@ -124,90 +461,207 @@ static void save_val(FILE *fp, Val val) {
             double f;
         }) {.f = val.float_data}.i;
         for (int i = 7; i >= 0; i--)
-            s_fputc((uint8_t)(n >> 8 * i), fp);
+            put_byte(buf, (uint8_t)(n >> 8 * i));
         break;
     }
     case TYPE_BOOL:
-        s_fputc((uint8_t)val.int_data, fp);
+        put_byte(buf, (uint8_t)val.int_data);
+        break;
+    case TYPE_CHAR:
+        put_varint(buf, val.char_data);
         break;
     case TYPE_CONST_STRING:
     case TYPE_SYMBOL:
-        save_string(fp, val.string_data);
+        put_varint(buf, string_index(strings, val.string_data));
         break;
     case TYPE_CONST_PAIR:
-        save_val(fp, val.pair_data->car);
-        save_val(fp, val.pair_data->cdr);
-        break;
+        return save_val(buf, strings, val.pair_data->car, invalid)
+            && save_val(buf, strings, val.pair_data->cdr, invalid);
     case TYPE_NIL:
     case TYPE_VOID:
     case TYPE_UNDEF:
         break;
     default:
-        eprintf("Error: value of type %s not a valid literal\n", type_name(val.type));
-        exit(1);
+        *invalid = val;
+        return 0;
     }
+    return 1;
 }
 
-static const char *magic = "\xf0\x9f\x91\xad";
-static const char *version = "v4.1";
+static void save_uint32(FILE *fp, uint32_t n) {
+    for (int i = 3; i >= 0; i--)
+        s_fputc((uint8_t)(n >> 8 * i), fp);
+}
 
-void save_insts(FILE *fp, uint32_t start, uint32_t end) {
-    s_fputs(magic, fp);
-    s_fputs(version, fp);
+static void save_bytes(FILE *fp, const void *data, size_t size) {
+    if (size != 0 && fwrite(data, 1, size, fp) != size) {
+        eprintf("Error: fwrite() failed\n");
+        exit(1);
+    }
+}
+
+/* -- try_save_insts
+ * Writes the instructions from `start` to `end` as a bytecode file.
+ * Returns 0 without writing anything if one of their constants can't be
+ * written, such as a vector, storing it in `invalid`.
+ */
+int try_save_insts(FILE *fp, uint32_t start, uint32_t end, Val *invalid) {
+    int saved = 1;
+    String_table strings = {{NULL, 0, 0}, 0, NULL, NULL, 64};
+    strings.slots = calloc(strings.slots_size, sizeof(uint32_t));
+    if (strings.slots == NULL) {
+        eprintf("Error: out of memory\n");
+        exit(1);
+    }
+    load_lazy_lambdas(start, end);
+    Buffer code = {NULL, 0, 0};
+    Buffer relocs = {NULL, 0, 0};
+    uint32_t consts_num = 0;
+    uint32_t relocs_num = 0;
+    uint32_t last_reloc = 0;
+    // the offset in bytes and number of constants before each instruction
+    size_t *offsets = s_malloc((end - start + 1) * sizeof(size_t));
+    uint32_t *consts_before = s_malloc((end - start + 1) * sizeof(uint32_t));
     for (uint32_t n = start; n != end; n++) {
-        s_fputc((int)insts[n].type, fp);
-        switch (insts[n].type) {
+        offsets[n - start] = code.len;
+        consts_before[n - start] = consts_num;
+        enum Inst_type type = generic_type(insts[n].type);
+        put_byte(&code, (unsigned char)type);
+        switch (type) {
         case INST_CONST:
-            save_val(fp, insts[n].val);
+            if (!save_val(&code, &strings, consts[insts[n].index], invalid)) {
+                saved = 0;
+                goto done;
+            }
+            consts_num++;
             break;
         case INST_VAR:
         case INST_SET:
-            save_uint32(fp, insts[n].var.frame);
-            save_uint32(fp, insts[n].var.index);
+            put_varint(&code, (uint32_t)(insts[n].var.frame + 1));
+            put_varint(&code, insts[n].var.index);
             break;
         case INST_NAME:
         case INST_DEF:
         case INST_SET_NAME:
-            save_string(fp, insts[n].name);
+            put_varint(&code, string_index(&strings, consts[insts[n].index].string_data));
+            consts_num++;
             break;
         case INST_JUMP:
         case INST_JUMP_FALSE:
-            save_uint32(fp, insts[n].index - start);
+            put_varint(&code, insts[n].index - start);
             break;
-        case INST_LAMBDA: {
-            save_uint32(fp, insts[n].lambda.params);
-            save_uint32(fp, insts[n].lambda.index - start);
+        case INST_LAMBDA:
+            put_varint(&code, insts[n].lambda.params);
+            put_varint(&code, insts[n].lambda.index - start);
             break;
-        }
         case INST_CALL:
         case INST_TAIL_CALL:
-            save_uint32(fp, insts[n].num);
+            put_varint(&code, insts[n].num);
             break;
         case INST_RETURN:
         case INST_DELETE:
         case INST_CONS:
         case INST_EXPR:
         case INST_EOF:
+        case INST_ADD:
+        case INST_SUB:
+        case INST_LT:
+        case INST_NUM_EQ:
             break;
+        default:
+            eprintf("Error: invalid instruction type (%d)\n", type);
+            exit(1);
         }
+        if (type == INST_JUMP || type == INST_JUMP_FALSE || type == INST_LAMBDA) {
+            put_varint(&relocs, n - start - last_reloc);
+            last_reloc = n - start;
+            relocs_num++;
+        }
+    }
+    offsets[end - start] = code.len;
+    consts_before[end - start] = consts_num;
+
+    // the outermost lambdas are found backwards, since bodies precede their INST_LAMBDA
+    Buffer index = {NULL, 0, 0};
+    uint32_t lambdas_num = 0;
+    uint32_t *lambdas = s_malloc((end - start + 1) * sizeof(uint32_t));
+    uint32_t outer_body = end;
+    for (uint32_t n = end; n-- > start; ) {
+        if (insts[n].type != INST_LAMBDA || n >= outer_body)
+            continue;
+        outer_body = insts[n].lambda.index;
+        if (n - outer_body >= LAZY_MIN_BODY && outer_body > start
+                && insts[outer_body - 1].type == INST_JUMP && insts[outer_body - 1].index == n)
+            lambdas[lambdas_num++] = n;
+    }
+    uint32_t last_end = start;
+    for (uint32_t i = lambdas_num; i-- > 0; ) {
+        uint32_t body = insts[lambdas[i]].lambda.index, lambda = lambdas[i];
+        put_varint(&index, body - last_end);
+        put_varint(&index, lambda - body);
+        put_varint(&index, offsets[body - start] - offsets[last_end - start]);
+        put_varint(&index, offsets[lambda - start] - offsets[body - start]);
+        put_varint(&index, consts_before[lambda - start] - consts_before[body - start]);
+        last_end = lambda;
     }
+
+    s_fputs(magic, fp);
+    s_fputs(version, fp);
+    save_uint32(fp, strings.num);
+    save_uint32(fp, consts_num);
+    save_uint32(fp, end - start);
+    save_uint32(fp, relocs_num);
+    save_uint32(fp, lambdas_num);
+    save_bytes(fp, index.data, index.len);
+    save_bytes(fp, strings.buf.data, strings.buf.len);
+    save_bytes(fp, code.data, code.len);
+    save_bytes(fp, relocs.data, relocs.len);
+    free(index.data);
+    free(lambdas);
+done:
+    free(strings.buf.data);
+    free(strings.strings);
+    free(strings.slots);
+    free(code.data);
+    free(relocs.data);
+    free(offsets);
+    free(consts_before);
+    return saved;
 }
 
-static unsigned char s_fgetc2(FILE *f) {
-    int c = s_fgetc(f);
-    if (c == EOF) {
-        eprintf("Error: unexpected end of file\n");
+/* -- save_insts
+ * Writes the instructions from `start` to `end` as a bytecode file,
+ * exiting if one of their constants can't be written.
+ */
+void save_insts(FILE *fp, uint32_t start, uint32_t end) {
+    Val invalid;
+    if (!try_save_insts(fp, start, end, &invalid)) {
+        eprintf("Error: value of type %s not a valid literal\n", type_name(invalid.type));
         exit(1);
     }
+}
+
+static void invalid_bytecode(void) {
+    eprintf("Error: invalid bytecode file\n");
+    exit(1);
+}
+
+static void unexpected_eof(void) {
+    eprintf("Error: unexpected end of file\n");
+    exit(1);
+}
+
+static unsigned char s_fgetc2(FILE *f) {
+    int c = s_fgetc(f);
+    if (c == EOF)
+        unexpected_eof();
     return (unsigned char)c;
 }
 
 static char32_t s_fgetc32_2(FILE *f) {
     int32_t c = s_fgetc32(f);
-    if (c == EOF32) {
-        eprintf("Error: unexpected end of file\n");
-        exit(1);
-    }
+    if (c == EOF32)
+        unexpected_eof();
     return (char32_t)c;
 }
 
@@ -272,26 +726,19 @@ static Val load_val(FILE *fp) {
     }
 }
 
-void load_insts(FILE *fp) {
+/* -- load_insts_4
+ * Loads the rest of a v4.1 bytecode file, in which every operand has
+ * a fixed size and every string is written out where it is used.
+ */
+static void load_insts_4(FILE *fp) {
     uint32_t start = this_inst();
-    char s[5];
-    s_fgets(s, 5, fp);
-    if (strcmp(s, magic) != 0) {
-        eprintf("Error: not a valid bytecode file\n");
-        exit(1);
-    }
-    s_fgets(s, 5, fp);
-    if (strcmp(s, version) != 0) {
-        eprintf("Error: invalid bytecode file version %s\n", s);
-        exit(1);
-    }
     int c;
     while ((c = s_fgetc(fp)) != EOF) {
         uint32_t n = next_inst();
         insts[n].type = (enum Inst_type)c;
         switch (insts[n].type) {
         case INST_CONST:
-            insts[n].val = load_val(fp);
+            insts[n].index = new_const(load_val(fp));
             break;
         case INST_VAR:
         case INST_SET:
@@ -301,7 +748,7 @@ void load_insts(FILE *fp) {
         case INST_NAME:
         case INST_DEF:
         case INST_SET_NAME:
-            insts[n].name = intern_string(load_str(fp));
+            insts[n].index = new_const((Val){TYPE_SYMBOL, {.string_data = intern_string(load_str(fp))}});
             break;
         case INST_JUMP:
         case INST_JUMP_FALSE:
@@ -320,10 +767,499 @@ void load_insts(FILE *fp) {
         case INST_CONS:
         case INST_EXPR:
             break;
+        case INST_ADD:
+        case INST_SUB:
+        case INST_LT:
+        case INST_NUM_EQ:
+            insts[n].num = 2;
+            break;
         default:
             eprintf("Error: invalid instruction type (%d)\n", insts[n].type);
             exit(1);
         }
     }
     insts[next_inst()] = (Inst){INST_EOF};
+    specialize_insts(start, this_inst());
+}
+
+/* -- Reader
+ * The part of a bytecode file in memory left to decode.
+ */
+typedef struct Reader {
+    const unsigned char *ptr;
+    const unsigned char *end;
+} Reader;
+
+static unsigned char get_byte(Reader *r) {
+    if (r->ptr == r->end)
+        unexpected_eof();
+    return *r->ptr++;
+}
+
+static uint64_t get_varint(Reader *r) {
+    uint64_t n = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        unsigned char c = get_byte(r);
+        n |= (uint64_t)(c & 0x7F) << shift;
+        if (c < 0x80)
+            return n;
+    }
+    invalid_bytecode();
+    return 0;
+}
+
+static uint32_t get_varint32(Reader *r) {
+    uint64_t n = get_varint(r);
+    if (n > UINT32_MAX)
+        invalid_bytecode();
+    return (uint32_t)n;
+}
+
+static uint32_t get_uint32(Reader *r) {
+    uint32_t n = 0;
+    for (int i = 0; i < 4; i++)
+        n = n << 8 | get_byte(r);
+    return n;
+}
+
+/* -- Loaded_string
+ * An entry of the string table of a file being loaded. It's decoded
+ * the first time it's used as a constant string or as a symbol.
+ */
+typedef struct Loaded_string {
+    const unsigned char *utf8;
+    size_t size;
+    size_t len;
+    String *str;
+    String *symbol;
+} Loaded_string;
+
+/* -- decode_utf8
+ * Decodes the `len` characters of a string table entry, the ASCII ones
+ * without any checks.
+ */
+static void decode_utf8(char32_t *chars, const Loaded_string *s) {
+    const unsigned char *p = s->utf8, *end = s->utf8 + s->size;
+    size_t i = 0;
+    while (i < s->len && p < end) {
+        if (*p < 0x80) {
+            chars[i++] = *p++;
+            continue;
+        }
+        int extra = *p >= 0xF0 ? 3 : *p >= 0xE0 ? 2 : *p >= 0xC0 ? 1 : -1;
+        if (extra < 0 || end - p <= extra)
+            break;
+        char32_t c = *p++ & (0x3F >> extra);
+        for (int j = 0; j < extra && (*p & 0xC0) == 0x80; j++)
+            c = c << 6 | (*p++ & 0x3F);
+        chars[i++] = c;
+    }
+    if (i != s->len || p != end) {
+        eprintf("Error: invalid UTF-8 input\n");
+        exit(1);
+    }
+}
+
+static Loaded_string *get_string(Reader *r, Loaded_string *strings, uint32_t strings_num) {
+    uint32_t i = get_varint32(r);
+    if (i >= strings_num)
+        invalid_bytecode();
+    return &strings[i];
+}
+
+static String *get_const_string(Reader *r, Loaded_string *strings, uint32_t strings_num) {
+    Loaded_string *s = get_string(r, strings, strings_num);
+    if (s->str == NULL) {
+        s->str = s_malloc(sizeof(String) + s->len * sizeof(char32_t));
+        s->str->len = s->len;
+        decode_utf8(s->str->chars, s);
+    }
+    return s->str;
+}
+
+static String *get_symbol(Reader *r, Loaded_string *strings, uint32_t strings_num) {
+    Loaded_string *s = get_string(r, strings, strings_num);
+    if (s->symbol == NULL) {
+        char32_t buf[64];
+        char32_t *chars = s->len <= 64 ? buf : s_malloc(s->len * sizeof(char32_t));
+        decode_utf8(chars, s);
+        s->symbol = new_interned_string(s->len, chars);
+        if (chars != buf)
+            free(chars);
+    }
+    return s->symbol;
+}
+
+static Val get_val(Reader *r, Loaded_string *strings, uint32_t strings_num) {
+    unsigned char type = get_byte(r);
+    switch (type) {
+    case TYPE_INT: {
+        uint64_t n = get_varint(r);
+        return (Val){TYPE_INT, {.int_data = (long long)(n >> 1 ^ -(n & 1))}};
+    }
+    case TYPE_FLOAT: {
+        uint64_t n = 0;
+        for (int i = 0; i < 8; i++)
+            n = n << 8 | get_byte(r);
+        double f = (union {
+            uint64_t i;
+            double f;
+        }) {.i = n}.f;
+        return (Val){TYPE_FLOAT, {.float_data = f}};
+    }
+    case TYPE_BOOL:
+        return (Val){TYPE_BOOL, {.int_data = get_byte(r)}};
+    case TYPE_CHAR:
+        return (Val){TYPE_CHAR, {.char_data = get_varint32(r)}};
+    case TYPE_CONST_STRING:
+        return (Val){TYPE_CONST_STRING, {.string_data = get_const_string(r, strings, strings_num)}};
+    case TYPE_SYMBOL:
+        return (Val){TYPE_SYMBOL, {.string_data = get_symbol(r, strings, strings_num)}};
+    case TYPE_CONST_PAIR: {
+        Pair *pair = s_malloc(sizeof(Pair));
+        pair->car = get_val(r, strings, strings_num);
+        pair->cdr = get_val(r, strings, strings_num);
+        return (Val){TYPE_CONST_PAIR, {.pair_data = pair}};
+    }
+    case TYPE_NIL:
+        return (Val){TYPE_NIL};
+    case TYPE_VOID:
+        return (Val){TYPE_VOID};
+    case TYPE_UNDEF:
+        return (Val){TYPE_UNDEF};
+    default:
+        eprintf("Error: invalid type (%d)\n", type);
+        exit(1);
+    }
+}
+
+/* -- reserve
+ * Grows the instructions and the constant pool to fit the given number
+ * of new ones, so that loading a file resizes them at most once.
+ */
+static void reserve(uint32_t insts_num, uint32_t consts_num) {
+    if (insts_num > insts_size - inst_index) {
+        while (insts_num > insts_size - inst_index)
+            insts_size *= 2;
+        insts = s_realloc(insts, insts_size * sizeof(Inst));
+    }
+    if (consts_num > consts_size - const_index) {
+        while (consts_num > consts_size - const_index)
+            consts_size *= 2;
+        consts = s_realloc(consts, consts_size * sizeof(Val));
+    }
+}
+
+/* -- get_inst
+ * Decodes the instruction at `n`, leaving its operand unrelocated.
+ */
+static void get_inst(Reader *r, Loaded_string *strings, uint32_t strings_num, uint32_t n) {
+    insts[n].type = (enum Inst_type)get_byte(r);
+    switch (insts[n].type) {
+    case INST_CONST:
+        insts[n].index = new_const(get_val(r, strings, strings_num));
+        break;
+    case INST_VAR:
+    case INST_SET:
+        insts[n].var.frame = get_varint32(r) - 1;
+        insts[n].var.index = get_varint32(r);
+        break;
+    case INST_NAME:
+    case INST_DEF:
+    case INST_SET_NAME:
+        insts[n].index = new_const((Val){TYPE_SYMBOL, {.string_data = get_symbol(r, strings, strings_num)}});
+        break;
+    case INST_JUMP:
+    case INST_JUMP_FALSE:
+        insts[n].index = get_varint32(r);
+        break;
+    case INST_LAMBDA:
+        insts[n].lambda.params = get_varint32(r);
+        insts[n].lambda.index = get_varint32(r);
+        break;
+    case INST_CALL:
+    case INST_TAIL_CALL:
+        insts[n].num = get_varint32(r);
+        break;
+    case INST_RETURN:
+    case INST_DELETE:
+    case INST_CONS:
+    case INST_EXPR:
+        break;
+    case INST_ADD:
+    case INST_SUB:
+    case INST_LT:
+    case INST_NUM_EQ:
+        insts[n].num = 2;
+        break;
+    default:
+        eprintf("Error: invalid instruction type (%d)\n", insts[n].type);
+        exit(1);
+    }
+}
+
+/* -- relocate
+ * Applies the relocation of the instruction at `n`, of a file of
+ * `insts_num` instructions loaded at `start`.
+ */
+static void relocate(uint32_t n, uint32_t start, uint32_t insts_num) {
+    uint32_t *target = insts[n].type == INST_LAMBDA ? &insts[n].lambda.index
+        : insts[n].type == INST_JUMP || insts[n].type == INST_JUMP_FALSE ? &insts[n].index
+        : NULL;
+    if (target == NULL || *target > insts_num)
+        invalid_bytecode();
+    *target += start;
+}
+
+/* -- Lazy_file
+ * A copy of a bytecode file some of whose lambdas haven't been loaded yet,
+ * with its decoded string table and relocations, kept until they all are.
+ */
+typedef struct Lazy_file {
+    unsigned char *data;
+    const unsigned char *code;
+    Loaded_string *strings;
+    uint32_t strings_num;
+    uint32_t *relocs;
+    uint32_t start;
+    uint32_t insts_num;
+    uint32_t lambdas_left;
+} Lazy_file;
+
+/* -- Lazy_lambda
+ * An entry of the lambda index of a file. Until it's loaded, its body
+ * from `body` to `end` is filled with INST_LAZY instructions. Its code
+ * is `size` bytes at `offset` in the instructions section of the file,
+ * and its relocations are `relocs_num` of those of the file from `relocs`.
+ */
+typedef struct Lazy_lambda {
+    Lazy_file *file;
+    size_t offset;
+    size_t size;
+    uint32_t body;
+    uint32_t end;
+    uint32_t relocs;
+    uint32_t relocs_num;
+} Lazy_lambda;
+
+static Lazy_lambda *lazy_lambdas = NULL;
+static uint32_t lazy_lambdas_size = 0;
+static uint32_t lazy_lambdas_num = 0;
+
+/* -- load_insts_5
+ * Decodes the rest of a v5 bytecode file, from `data` to `end`. If `lazy`
+ * is set, the lambdas in its index are left to be loaded when called.
+ */
+static void load_insts_5(const unsigned char *data, const unsigned char *end, int has_index, int lazy) {
+    uint32_t start = this_inst();
+    Reader r = {data, end};
+    uint32_t strings_num = get_uint32(&r);
+    uint32_t consts_num = get_uint32(&r);
+    uint32_t insts_num = get_uint32(&r);
+    uint32_t relocs_num = get_uint32(&r);
+    uint32_t lambdas_num = has_index ? get_uint32(&r) : 0;
+    // every string, instruction, relocation and lambda takes at least one byte
+    size_t size = (size_t)(end - data);
+    if (strings_num > size || insts_num > size || relocs_num > size || lambdas_num > size)
+        invalid_bytecode();
+
+    Lazy_file *file = NULL;
+    if (lazy && lambdas_num != 0) {
+        // the file is copied, since it can be overwritten before all its lambdas are loaded
+        file = s_malloc(sizeof(Lazy_file));
+        file->data = s_malloc(size);
+        memcpy(file->data, data, size);
+        r = (Reader){file->data + (r.ptr - data), file->data + size};
+        if (lazy_lambdas_num + lambdas_num > lazy_lambdas_size) {
+            while (lazy_lambdas_num + lambdas_num > lazy_lambdas_size)
+                lazy_lambdas_size = lazy_lambdas_size ? lazy_lambdas_size * 2 : 256;
+            lazy_lambdas = s_realloc(lazy_lambdas, lazy_lambdas_size * sizeof(Lazy_lambda));
+        }
+    }
+    uint32_t first_lazy = lazy_lambdas_num;
+    uint32_t lazy_consts = 0;
+    uint32_t last_end = 0;
+    size_t last_offset = 0;
+    for (uint32_t i = 0; i < lambdas_num; i++) {
+        uint32_t body = last_end + get_varint32(&r);
+        uint32_t len = get_varint32(&r);
+        size_t offset = last_offset + get_varint(&r);
+        size_t code_size = get_varint(&r);
+        uint32_t lambda_consts = get_varint32(&r);
+        if (len == 0 || body >= insts_num || len > insts_num - body)
+            invalid_bytecode();
+        last_end = body + len;
+        last_offset = offset + code_size;
+        if (file == NULL)
+            continue;
+        lazy_lambdas[lazy_lambdas_num++] = (Lazy_lambda){file, offset, code_size, start + body, start + last_end, 0, 0};
+        lazy_consts += lambda_consts;
+    }
+
+    Loaded_string *strings = s_malloc((strings_num + 1) * sizeof(Loaded_string));
+    for (uint32_t i = 0; i < strings_num; i++) {
+        strings[i].len = get_varint(&r);
+        strings[i].size = get_varint(&r);
+        if (strings[i].size > (size_t)(r.end - r.ptr))
+            unexpected_eof();
+        strings[i].utf8 = r.ptr;
+        strings[i].str = strings[i].symbol = NULL;
+        r.ptr += strings[i].size;
+    }
+
+    reserve(insts_num + 1, consts_num > lazy_consts ? consts_num - lazy_consts : 0);
+    const unsigned char *code = r.ptr;
+    uint32_t n = start;
+    uint32_t k = first_lazy;
+    while (n != start + insts_num) {
+        if (k == lazy_lambdas_num || n != lazy_lambdas[k].body) {
+            get_inst(&r, strings, strings_num, n++);
+            continue;
+        }
+        if ((size_t)(r.ptr - code) != lazy_lambdas[k].offset || lazy_lambdas[k].size > (size_t)(r.end - r.ptr))
+            invalid_bytecode();
+        r.ptr += lazy_lambdas[k].size;
+        while (n != lazy_lambdas[k].end)
+            insts[n++] = (Inst){INST_LAZY, {.index = k}};
+        k++;
+    }
+    inst_index = start + insts_num;
+
+    // the relocations of lazy lambdas are applied when they're loaded
+    uint32_t *relocs = s_malloc((relocs_num + 1) * sizeof(uint32_t));
+    n = start;
+    k = first_lazy;
+    for (uint32_t i = 0; i < relocs_num; i++) {
+        n += get_varint32(&r);
+        if (n >= inst_index)
+            invalid_bytecode();
+        relocs[i] = n;
+        while (k != lazy_lambdas_num && n >= lazy_lambdas[k].end)
+            k++;
+        if (k == lazy_lambdas_num || n < lazy_lambdas[k].body) {
+            relocate(n, start, insts_num);
+        } else {
+            if (lazy_lambdas[k].relocs_num++ == 0)
+                lazy_lambdas[k].relocs = i;
+        }
+    }
+
+    if (file == NULL) {
+        free(strings);
+        free(relocs);
+    } else {
+        *file = (Lazy_file){file->data, code, strings, strings_num, relocs, start, insts_num, lambdas_num};
+    }
+    insts[next_inst()] = (Inst){INST_EOF};
+    specialize_insts(start, this_inst());
+}
+
+/* -- load_lazy_lambda
+ * Loads the body of the lazy lambda containing the INST_LAZY instruction
+ * at `pc` in place, which is executed when the lambda is first called.
+ */
+void load_lazy_lambda(uint32_t pc) {
+    Lazy_lambda *lambda = &lazy_lambdas[insts[pc].index];
+    Lazy_file *file = lambda->file;
+    Reader r = {file->code + lambda->offset, file->code + lambda->offset + lambda->size};
+    for (uint32_t n = lambda->body; n != lambda->end; n++)
+        get_inst(&r, file->strings, file->strings_num, n);
+    if (r.ptr != r.end)
+        invalid_bytecode();
+    for (uint32_t i = lambda->relocs; i != lambda->relocs + lambda->relocs_num; i++)
+        relocate(file->relocs[i], file->start, file->insts_num);
+    // the last instruction of the body is specialized by the INST_LAMBDA following it
+    specialize_insts(lambda->body, lambda->end + 1);
+    lambda->file = NULL;
+    if (--file->lambdas_left == 0) {
+        free(file->data);
+        free(file->strings);
+        free(file->relocs);
+        free(file);
+    }
+}
+
+/* -- load_lazy_lambdas
+ * Loads all the lazy lambdas between `start` and `end`, before the
+ * instructions are written out or shown.
+ */
+void load_lazy_lambdas(uint32_t start, uint32_t end) {
+    for (uint32_t n = start; n < end; n++)
+        if (insts[n].type == INST_LAZY)
+            load_lazy_lambda(n);
+}
+
+/* -- is_bytecode
+ * Returns whether `data` starts like a bytecode file of the current version.
+ */
+int is_bytecode(const unsigned char *data, size_t size) {
+    return size >= 8 && memcmp(data, magic, 4) == 0 && memcmp(data + 4, version, 4) == 0;
+}
+
+/* -- load_bytecode
+ * Loads a bytecode file of the current version from memory. Unless `lazy` is
+ * set, its lambdas are all loaded right away, which is needed if machine code
+ * is installed for them. Otherwise, `data` can be freed after it returns.
+ */
+void load_bytecode(const unsigned char *data, size_t size, int lazy) {
+    if (size < 8 || memcmp(data, magic, 4) != 0) {
+        eprintf("Error: not a valid bytecode file\n");
+        exit(1);
+    }
+    if (memcmp(data + 4, version, 4) != 0) {
+        eprintf("Error: invalid bytecode file version %.4s\n", (const char *)data + 4);
+        exit(1);
+    }
+    load_insts_5(data + 8, data + size, 1, lazy);
+}
+
+/* -- load_insts
+ * Loads a bytecode file, appending its instructions to the program.
+ * A regular v5 file is mapped into memory and decoded from there, other
+ * ones are read into a buffer first. The bodies of the lambdas in its
+ * index are only loaded once they're called.
+ */
+void load_insts(FILE *fp) {
+    char s[5];
+    s_fgets(s, 5, fp);
+    if (strcmp(s, magic) != 0) {
+        eprintf("Error: not a valid bytecode file\n");
+        exit(1);
+    }
+    s_fgets(s, 5, fp);
+    if (strcmp(s, version_4) == 0) {
+        load_insts_4(fp);
+        return;
+    }
+    if (strcmp(s, version) != 0 && strcmp(s, version_5_0) != 0) {
+        eprintf("Error: invalid bytecode file version %s\n", s);
+        exit(1);
+    }
+    int has_index = strcmp(s, version) == 0;
+
+    struct stat st;
+    long offset = ftell(fp);
+    if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && offset >= 0 && offset <= st.st_size) {
+        size_t size = (size_t)st.st_size;
+        unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+        if (data != MAP_FAILED) {
+            load_insts_5(data + offset, data + size, has_index, 1);
+            munmap(data, size);
+            return;
+        }
+    }
+    Buffer buf = {NULL, 0, 0};
+    do {
+        if (buf.size - buf.len < 4096) {
+            buf.size = buf.size ? buf.size * 2 : 65536;
+            buf.data = s_realloc(buf.data, buf.size);
+        }
+        buf.len += fread(buf.data + buf.len, 1, buf.size - buf.len, fp);
+    } while (!feof(fp) && !ferror(fp));
+    if (ferror(fp)) {
+        eprintf("Error: could not read file\n");
+        exit(1);
+    }
+    load_insts_5(buf.data, buf.data + buf.len, has_index, 1);
+    free(buf.data);
 }
@@ -2,16 +2,45 @@
 #include "types.h"
 
 Inst *insts;
+Val *consts;
 uint32_t return_inst;
 uint32_t tail_call_inst;
 uint32_t map_continue_inst;
 uint32_t for_each_continue_inst;
 uint32_t compiler_pc;
+uint32_t compiler_consts;
 uint32_t compile_pc;
-uint32_t parse_pc;
+
+/* -- Source_pos
+ * An entry of the source position table, indicating that the code starting
+ * at instruction `inst` was compiled from the top-level expression starting
+ * at line `line` of file `file`. Entries are ordered by `inst`.
+ */
+typedef struct Source_pos {
+    uint32_t inst;
+    uint32_t line;
+    const char *file;
+} Source_pos;
+
 void setup_insts(void);
+FILE *open_compiler(void);
+void load_compiler(void);
 uint32_t next_inst(void);
 uint32_t this_inst(void);
+uint32_t this_const(void);
+uint32_t new_const(Val val);
+void add_source_pos(uint32_t inst, const char *file, uint32_t line);
+const Source_pos *find_source_pos(uint32_t inst);
+uint32_t *find_lambdas(void);
+void print_lambda(FILE *f, uint32_t lambda);
 uint32_t next_expr(uint32_t start);
+enum Inst_type specialized_type(uint32_t n);
+void specialize_insts(uint32_t start, uint32_t end);
+enum Inst_type generic_type(enum Inst_type type);
+int try_save_insts(FILE *fp, uint32_t start, uint32_t end, Val *invalid);
 void save_insts(FILE *fp, uint32_t start, uint32_t end);
 void load_insts(FILE *fp);
+int is_bytecode(const unsigned char *data, size_t size);
+void load_bytecode(const unsigned char *data, size_t size, int lazy);
+void load_lazy_lambda(uint32_t pc);
+void load_lazy_lambdas(uint32_t start, uint32_t end);
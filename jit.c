@@ -0,0 +1,544 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "alloc_profile.h"
+#include "exec_gc.h"
+#include "insts.h"
+#include "primitives.h"
+#include "profile.h"
+#include "safestd.h"
+#include "types.h"
+#include "primitives/number.h"
+
+/* == jit.c
+ * The JIT compiler translates the body of a lambda to x86-64 machine code
+ * once the lambda has been called JIT_THRESHOLD times. Each instruction is
+ * translated on its own to a template doing the same to the stack, which
+ * stays in memory, so the code of a sequence of instructions runs straight
+ * through without dispatching. The fixnum paths of the inlined arithmetic
+ * instructions and calls of primitives are done directly as well.
+ *
+ * Instructions which aren't translated, and those whose guards fail, exit
+ * the machine code, returning the instruction to the interpreter. Guards are
+ * checked before anything is changed, so exiting deoptimizes the instruction:
+ * the interpreter executes it again, and continues with the rest of the body.
+ * The arithmetic instructions check that their arguments are fixnums and
+ * that the global is still bound to the primitive, so redefining it exits.
+ *
+ * Calls of lambdas exit as well. So that the machine code continues once the
+ * lambda returns, the call is made by a copy of the call instruction followed
+ * by INST_JIT, which enters the machine code after the call. setup_jit()
+ * reserves these pairs of instructions in advance, since new instructions
+ * can't be added while the compiler may be in the middle of emitting code.
+ *
+ * While in machine code, `rbx` holds `stack_ptr`, which is stored back
+ * before calling a primitive and when exiting. Everything else, such as
+ * `exec_env`, is loaded when used, as the garbage collector may move it.
+ */
+
+#ifdef NATIVE_CODE
+
+#define JIT_TRAMPOLINES 4096
+
+/* -- trampolines
+ * The first of the pairs of instructions reserved for calls of lambdas from
+ * native code. `trampoline_calls` holds the call instruction copied
+ * by each pair in use.
+ */
+static uint32_t trampolines;
+static uint32_t trampolines_used = 0;
+static uint32_t *trampoline_calls;
+
+void setup_jit(void) {
+    trampolines = this_inst();
+    for (uint32_t i = 0; i < 2 * JIT_TRAMPOLINES; i++) {
+        // next_inst() may move `insts`
+        uint32_t n = next_inst();
+        insts[n] = (Inst){INST_EOF};
+    }
+    jit_resumes = s_malloc(JIT_TRAMPOLINES * sizeof(Native_code));
+    trampoline_calls = s_malloc(JIT_TRAMPOLINES * sizeof(uint32_t));
+}
+
+void grow_jit_entries(void) {
+    uint32_t new_size = jit_entries_size ? jit_entries_size : 4096;
+    while (new_size < this_inst())
+        new_size *= 2;
+    jit_entries = s_realloc(jit_entries, new_size * sizeof(Jit_entry));
+    memset(jit_entries + jit_entries_size, 0, (new_size - jit_entries_size) * sizeof(Jit_entry));
+    jit_entries_size = new_size;
+}
+
+/* -- set_native_code
+ * Makes exec() run `code` when entering the lambda body starting at `body`.
+ */
+void set_native_code(uint32_t body, Native_code code) {
+    if (body >= jit_entries_size)
+        grow_jit_entries();
+    jit_entries[body].code = code;
+}
+
+/* -- add_trampoline
+ * Sets up a trampoline making the call at `call`, after which `resume`
+ * is run, and returns its first instruction, or `call` if none is left.
+ */
+uint32_t add_trampoline(uint32_t call, Native_code resume) {
+    if (trampolines_used == JIT_TRAMPOLINES)
+        return call;
+    uint32_t i = trampolines_used++;
+    trampoline_calls[i] = call;
+    jit_resumes[i] = resume;
+    insts[trampolines + 2 * i] = (Inst){INST_CALL, {.num = insts[call].num}};
+    insts[trampolines + 2 * i + 1] = (Inst){INST_JIT, {.index = i}};
+    return trampolines + 2 * i;
+}
+
+#endif
+
+#ifdef JIT
+
+#define JIT_MAX_BODY 8192
+
+#define VAL_SIZE ((int32_t)sizeof(Val))
+#define VAL_TYPE ((int32_t)offsetof(Val, type))
+#define VAL_DATA ((int32_t)offsetof(Val, int_data))
+
+enum {RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSI = 6, RDI = 7};
+enum {JUMP_ALWAYS = -1, COND_E = 0x4, COND_NE = 0x5, COND_A = 0x7};
+
+/* -- Fixup
+ * A 32-bit relative jump at offset `at` in the code, to the code of the
+ * instruction `target`, or to an exit to it if `exit` is set.
+ */
+typedef struct Fixup {
+    size_t at;
+    uint32_t target;
+    int exit;
+} Fixup;
+
+static uint8_t *code = NULL;
+static size_t code_len, code_size = 0;
+static Fixup *fixups = NULL;
+static size_t fixups_num, fixups_size = 0;
+static size_t *labels = NULL;
+static uint32_t body_start, body_end;
+
+static void emit(uint8_t byte) {
+    if (code_len == code_size) {
+        code_size = code_size ? code_size * 2 : 4096;
+        code = s_realloc(code, code_size);
+    }
+    code[code_len++] = byte;
+}
+
+static void emit_u32(uint32_t n) {
+    for (int i = 0; i < 4; i++)
+        emit((uint8_t)(n >> 8 * i));
+}
+
+static void emit_u64(uint64_t n) {
+    for (int i = 0; i < 8; i++)
+        emit((uint8_t)(n >> 8 * i));
+}
+
+/* -- emit_mem
+ * Emits the ModRM byte and displacement of the operand [base + disp],
+ * with `reg` in the reg field. `base` can't be rsp.
+ */
+static void emit_mem(int reg, int base, int32_t disp) {
+    emit((uint8_t)(0x80 | reg << 3 | base));
+    emit_u32((uint32_t)disp);
+}
+
+// mov reg, imm64
+static void emit_mov_imm64(int reg, uint64_t n) {
+    emit(0x48);
+    emit((uint8_t)(0xb8 + reg));
+    emit_u64(n);
+}
+
+static void emit_mov_addr(int reg, const volatile void *addr) {
+    emit_mov_imm64(reg, (uint64_t)(uintptr_t)addr);
+}
+
+// mov reg, qword [base + disp]
+static void emit_load64(int reg, int base, int32_t disp) {
+    emit(0x48);
+    emit(0x8b);
+    emit_mem(reg, base, disp);
+}
+
+// mov qword [base + disp], reg
+static void emit_store64(int base, int32_t disp, int reg) {
+    emit(0x48);
+    emit(0x89);
+    emit_mem(reg, base, disp);
+}
+
+// mov reg, dword [base + disp]
+static void emit_load32(int reg, int base, int32_t disp) {
+    emit(0x8b);
+    emit_mem(reg, base, disp);
+}
+
+// mov dword [base + disp], reg
+static void emit_store32(int base, int32_t disp, int reg) {
+    emit(0x89);
+    emit_mem(reg, base, disp);
+}
+
+// mov dword [base + disp], imm32
+static void emit_store_imm32(int base, int32_t disp, uint32_t n) {
+    emit(0xc7);
+    emit_mem(0, base, disp);
+    emit_u32(n);
+}
+
+// cmp dword [base + disp], imm32
+static void emit_cmp_imm32(int base, int32_t disp, uint32_t n) {
+    emit(0x81);
+    emit_mem(7, base, disp);
+    emit_u32(n);
+}
+
+// lea reg, [base + disp]
+static void emit_lea(int reg, int base, int32_t disp) {
+    emit(0x48);
+    emit(0x8d);
+    emit_mem(reg, base, disp);
+}
+
+/* -- emit_jump
+ * Emits a jump, conditional unless `cond` is JUMP_ALWAYS, to the code of
+ * the instruction `target` if it is in the body, and otherwise to an exit to it.
+ */
+static void emit_jump(int cond, uint32_t target) {
+    if (cond == JUMP_ALWAYS) {
+        emit(0xe9);
+    } else {
+        emit(0x0f);
+        emit((uint8_t)(0x80 | cond));
+    }
+    if (fixups_num == fixups_size) {
+        fixups_size = fixups_size ? fixups_size * 2 : 256;
+        fixups = s_realloc(fixups, fixups_size * sizeof(Fixup));
+    }
+    fixups[fixups_num++] = (Fixup){code_len, target, target < body_start || target >= body_end};
+    emit_u32(0);
+}
+
+/* -- emit_exit
+ * Emits a jump, conditional unless `cond` is JUMP_ALWAYS, which exits
+ * to the interpreter at the instruction `pc`.
+ */
+static void emit_exit(int cond, uint32_t pc) {
+    emit_jump(cond, pc);
+    fixups[fixups_num - 1].exit = 1;
+}
+
+static int32_t binding_disp(uint32_t index) {
+    return (int32_t)(index * sizeof(Binding) + offsetof(Binding, val));
+}
+
+// rax = global_env->bindings
+static void emit_load_bindings(void) {
+    emit_mov_addr(RAX, &global_env);
+    emit_load64(RAX, RAX, 0);
+    emit_load64(RAX, RAX, (int32_t)offsetof(Global_env, bindings));
+}
+
+/* -- emit_push_var
+ * Pushes the value at [rax + disp], or exits at `pc` if it's undefined,
+ * leaving the interpreter to report the error.
+ */
+static void emit_push_var(uint32_t pc, int32_t disp) {
+    emit_load32(RCX, RAX, disp + VAL_TYPE);
+    emit(0x81); // cmp ecx, imm32
+    emit(0xf9);
+    emit_u32(TYPE_UNDEF);
+    emit_exit(COND_E, pc);
+    emit_load64(RDX, RAX, disp + VAL_DATA);
+    emit_store32(RBX, VAL_TYPE, RCX);
+    emit_store64(RBX, VAL_DATA, RDX);
+    emit_lea(RBX, RBX, VAL_SIZE);
+}
+
+static void emit_var(uint32_t pc, Env_loc var) {
+    if (var.frame == UINT32_MAX) {
+        emit_load_bindings();
+        emit_push_var(pc, binding_disp(var.index));
+        return;
+    }
+    emit_mov_addr(RAX, &exec_env);
+    emit_load64(RAX, RAX, 0);
+    for (uint32_t i = 0; i < var.frame; i++)
+        emit_load64(RAX, RAX, (int32_t)offsetof(Env, outer));
+    emit_push_var(pc, (int32_t)(offsetof(Env, vals) + var.index * sizeof(Val)));
+}
+
+static void emit_const(Val val) {
+    emit_store_imm32(RBX, VAL_TYPE, (uint32_t)val.type);
+    emit_mov_imm64(RAX, (uint64_t)val.int_data);
+    emit_store64(RBX, VAL_DATA, RAX);
+    emit_lea(RBX, RBX, VAL_SIZE);
+}
+
+static void emit_jump_false(uint32_t pc) {
+    emit_lea(RBX, RBX, -VAL_SIZE);
+    emit_cmp_imm32(RBX, VAL_TYPE, TYPE_BOOL);
+    emit_jump(COND_NE, pc + 1);
+    emit(0x48); // cmp qword [rbx + VAL_DATA], 0
+    emit(0x83);
+    emit_mem(7, RBX, VAL_DATA);
+    emit(0);
+    emit_jump(COND_E, insts[pc].index);
+}
+
+/* -- emit_arith
+ * Emits an inlined arithmetic instruction, which exits unless the global
+ * at `binding` is still `prim`, and both arguments are fixnums.
+ */
+static void emit_arith(uint32_t pc, uint32_t binding, Val (*prim)(Val *, uint32_t)) {
+    emit_load_bindings();
+    emit_cmp_imm32(RAX, binding_disp(binding) + VAL_TYPE, TYPE_PRIM);
+    emit_exit(COND_NE, pc);
+    emit_mov_addr(RCX, (void *)prim);
+    emit(0x48); // cmp qword [rax + disp], rcx
+    emit(0x39);
+    emit_mem(RCX, RAX, binding_disp(binding) + VAL_DATA);
+    emit_exit(COND_NE, pc);
+    emit_cmp_imm32(RBX, -2 * VAL_SIZE + VAL_TYPE, TYPE_INT);
+    emit_exit(COND_NE, pc);
+    emit_cmp_imm32(RBX, -VAL_SIZE + VAL_TYPE, TYPE_INT);
+    emit_exit(COND_NE, pc);
+    emit_load64(RAX, RBX, -2 * VAL_SIZE + VAL_DATA);
+    emit(0x48);
+    switch (insts[pc].type) {
+    case INST_ADD:
+        emit(0x03); // add rax, [rbx + disp]
+        emit_mem(RAX, RBX, -VAL_SIZE + VAL_DATA);
+        break;
+    case INST_SUB:
+        emit(0x2b); // sub rax, [rbx + disp]
+        emit_mem(RAX, RBX, -VAL_SIZE + VAL_DATA);
+        break;
+    default:
+        emit(0x3b); // cmp rax, [rbx + disp]
+        emit_mem(RAX, RBX, -VAL_SIZE + VAL_DATA);
+        emit(0x0f); // setl al / sete al
+        emit(insts[pc].type == INST_LT ? 0x9c : 0x94);
+        emit(0xc0);
+        emit(0x0f); // movzx eax, al
+        emit(0xb6);
+        emit(0xc0);
+        emit_store_imm32(RBX, -2 * VAL_SIZE + VAL_TYPE, TYPE_BOOL);
+        break;
+    }
+    emit_store64(RBX, -2 * VAL_SIZE + VAL_DATA, RAX);
+    emit_lea(RBX, RBX, -VAL_SIZE);
+}
+
+static void call_prim(Val *op, uint32_t num) {
+    *op = op->prim_data(op + 1, num);
+}
+
+/* -- emit_call
+ * Emits a call, which calls a primitive directly and exits otherwise.
+ * A call which isn't a tail call exits to a trampoline if one is left.
+ */
+static void emit_call(uint32_t pc, int tail) {
+    uint32_t num = insts[pc].num;
+    int32_t op = -(int32_t)(num + 1) * VAL_SIZE;
+    uint32_t call_pc = pc;
+    if (!tail && pc + 1 < body_end && trampolines_used < JIT_TRAMPOLINES) {
+        trampoline_calls[trampolines_used] = pc;
+        call_pc = trampolines + 2 * trampolines_used++;
+    }
+    emit_cmp_imm32(RBX, op + VAL_TYPE, TYPE_PRIM);
+    emit_exit(COND_NE, call_pc);
+    // the interpreter takes profiling samples at calls
+    emit_mov_addr(RAX, &profile_pending);
+    emit_cmp_imm32(RAX, 0, 0);
+    emit_exit(COND_NE, pc);
+#ifdef ALLOC_PROFILE
+    emit_mov_addr(RAX, &alloc_pc);
+    emit_store_imm32(RAX, 0, pc);
+#endif
+    emit_mov_addr(RAX, &stack_ptr);
+    emit_store64(RAX, 0, RBX);
+    emit_lea(RDI, RBX, op);
+    emit(0xbe); // mov esi, imm32
+    emit_u32(num);
+    emit_mov_addr(RAX, (void *)call_prim);
+    emit(0xff); // call rax
+    emit(0xd0);
+    emit_lea(RBX, RBX, op + VAL_SIZE);
+    if (tail)
+        emit_exit(JUMP_ALWAYS, return_inst);
+}
+
+static void compile_inst(uint32_t pc) {
+    switch (insts[pc].type) {
+    case INST_CONST:
+    case INST_CONST_CALL:
+    case INST_CONST_RETURN:
+        emit_const(consts[insts[pc].index]);
+        break;
+    case INST_VAR:
+    case INST_VAR_0:
+    case INST_VAR_1:
+    case INST_GLOBAL:
+    case INST_VAR_CALL:
+    case INST_CALL_GLOBAL:
+    case INST_VAR_JUMP_FALSE:
+        // the second instruction of a superinstruction follows
+        emit_var(pc, insts[pc].var);
+        break;
+    case INST_JUMP:
+        emit_jump(JUMP_ALWAYS, insts[pc].index);
+        break;
+    case INST_JUMP_FALSE:
+        emit_jump_false(pc);
+        break;
+    case INST_DELETE:
+        emit_lea(RBX, RBX, -VAL_SIZE);
+        break;
+    case INST_EXPR:
+        break;
+    case INST_ADD:
+        emit_arith(pc, add_binding, add_prim);
+        break;
+    case INST_SUB:
+        emit_arith(pc, sub_binding, sub_prim);
+        break;
+    case INST_LT:
+        emit_arith(pc, lt_binding, lt_prim);
+        break;
+    case INST_NUM_EQ:
+        emit_arith(pc, num_eq_binding, equ_prim);
+        break;
+    case INST_CALL:
+        emit_call(pc, 0);
+        break;
+    case INST_TAIL_CALL:
+        emit_call(pc, 1);
+        break;
+    default:
+        emit_exit(JUMP_ALWAYS, pc);
+        break;
+    }
+}
+
+/* -- emit_entry
+ * Emits the code entering the body at `pc`. It exits right away if pushing
+ * a value for every instruction of the body could overflow the stack,
+ * which is enough as the body only jumps forward.
+ */
+static size_t emit_entry(uint32_t pc) {
+    size_t entry = code_len;
+    emit(0x53); // push rbx
+    emit_mov_addr(RAX, &stack_ptr);
+    emit_load64(RBX, RAX, 0);
+    emit_lea(RAX, RBX, (int32_t)(body_end - body_start) * VAL_SIZE);
+    emit_mov_addr(RCX, stack + STACK_SIZE);
+    emit(0x48); // cmp rax, rcx
+    emit(0x39);
+    emit(0xc8);
+    emit_exit(COND_A, pc);
+    emit_jump(JUMP_ALWAYS, pc);
+    return entry;
+}
+
+/* -- emit_exits
+ * Emits the code which stores `stack_ptr` and returns to the interpreter,
+ * and resolves the jumps, adding a stub which sets the instruction
+ * to return for every jump which exits.
+ */
+static void emit_exits(void) {
+    size_t exit_code = code_len;
+    emit_mov_addr(RCX, &stack_ptr);
+    emit_store64(RCX, 0, RBX);
+    emit(0x5b); // pop rbx
+    emit(0xc3); // ret
+    for (size_t i = 0; i < fixups_num; i++) {
+        size_t dest = fixups[i].exit ? code_len : labels[fixups[i].target - body_start];
+        uint32_t rel = (uint32_t)(dest - (fixups[i].at + 4));
+        for (int j = 0; j < 4; j++)
+            code[fixups[i].at + (size_t)j] = (uint8_t)(rel >> 8 * j);
+        if (fixups[i].exit) {
+            emit(0xb8); // mov eax, imm32
+            emit_u32(fixups[i].target);
+            emit(0xe9); // jmp exit_code
+            emit_u32((uint32_t)(exit_code - (code_len + 4)));
+        }
+    }
+}
+
+/* -- jit_compile
+ * Compiles the body of a lambda starting at `body`, and runs it.
+ * Returns the instruction at which the interpreter continues.
+ */
+uint32_t jit_compile(uint32_t body) {
+    if (insts[body].type == INST_LAZY)
+        load_lazy_lambda(body);
+    uint32_t end = body;
+    while (end < this_inst() && !(insts[end].type == INST_LAMBDA && insts[end].lambda.index == body))
+        end++;
+    if (end == this_inst() || end - body > JIT_MAX_BODY)
+        return body;
+    for (uint32_t pc = body; pc < end; pc++)
+        if ((insts[pc].type == INST_JUMP || insts[pc].type == INST_JUMP_FALSE) && insts[pc].index <= pc)
+            return body;
+
+    body_start = body;
+    body_end = end;
+    code_len = 0;
+    fixups_num = 0;
+    uint32_t first_new_trampoline = trampolines_used;
+    labels = s_realloc(labels, (end - body) * sizeof(size_t));
+    for (uint32_t pc = body; pc < end; pc++) {
+        labels[pc - body] = code_len;
+        compile_inst(pc);
+    }
+    size_t entry = emit_entry(body);
+    size_t *resume_entries = s_malloc((trampolines_used - first_new_trampoline + 1) * sizeof(size_t));
+    for (uint32_t i = first_new_trampoline; i < trampolines_used; i++)
+        resume_entries[i - first_new_trampoline] = emit_entry(trampoline_calls[i] + 1);
+    emit_exits();
+
+    char *mem = mmap(NULL, code_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        eprintf("Error: out of memory for machine code\n");
+        exit(1);
+    }
+    memcpy(mem, code, code_len);
+    if (mprotect(mem, code_len, PROT_READ | PROT_EXEC) != 0) {
+        eprintf("Error: could not make machine code executable\n");
+        exit(1);
+    }
+    for (uint32_t i = first_new_trampoline; i < trampolines_used; i++) {
+        jit_resumes[i] = (Native_code)(void *)(mem + resume_entries[i - first_new_trampoline]);
+        insts[trampolines + 2 * i] = (Inst){INST_CALL, {.num = insts[trampoline_calls[i]].num}};
+        insts[trampolines + 2 * i + 1] = (Inst){INST_JIT, {.index = i}};
+    }
+    free(resume_entries);
+    set_native_code(body, (Native_code)(void *)(mem + entry));
+    return jit_entries[body].code();
+}
+
+#endif
+
+/* -- jit_source_pc
+ * Returns the call instruction copied by a trampoline, or the instruction
+ * following it for INST_JIT, and any other instruction unchanged.
+ */
+uint32_t jit_source_pc(uint32_t pc) {
+#ifdef NATIVE_CODE
+    if (pc >= trampolines && pc < trampolines + 2 * trampolines_used)
+        return trampoline_calls[(pc - trampolines) / 2] + (pc - trampolines) % 2;
+#endif
+    return pc;
+}
@@ -0,0 +1,48 @@
+#include "types.h"
+
+/* == jit.h
+ * The JIT compiler is only compiled in on x86-64 Linux, in which case JIT
+ * is defined. It is left out if NO_JIT is defined, and also if VM_STATS is,
+ * since instructions executed as machine code aren't counted.
+ * `jit_entries` is indexed by the first instruction of the body of a lambda.
+ * It counts the calls of the lambda, and holds its machine code once it has
+ * been called JIT_THRESHOLD times.
+ * Programs translated to C by --emit-c, which are compiled with AOT defined,
+ * install their lambdas there as well, so NATIVE_CODE is defined if either
+ * of them is.
+ */
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(NO_JIT) && !defined(VM_STATS)
+#define JIT
+#endif
+
+#if defined(JIT) || defined(AOT)
+#define NATIVE_CODE
+#endif
+
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 1000
+#endif
+
+/* -- Native_code
+ * Runs compiled machine code until it reaches an instruction it doesn't
+ * handle, or one of its guards fails, and returns the instruction at which
+ * the interpreter continues.
+ */
+typedef uint32_t (*Native_code)(void);
+
+typedef struct Jit_entry {
+    uint32_t calls;
+    Native_code code;
+} Jit_entry;
+
+Jit_entry *jit_entries;
+uint32_t jit_entries_size;
+Native_code *jit_resumes;
+
+void setup_jit(void);
+void grow_jit_entries(void);
+void set_native_code(uint32_t body, Native_code code);
+uint32_t add_trampoline(uint32_t call, Native_code resume);
+uint32_t jit_compile(uint32_t body);
+uint32_t jit_source_pc(uint32_t pc);
@@ -3,12 +3,18 @@
 #include <string.h>
 
 #include "types.h"
+#include "alloc_profile.h"
+#include "cache.h"
 #include "display.h"
+#include "emit_c.h"
 #include "env.h"
 #include "exec.h"
+#include "image.h"
 #include "insts.h"
 #include "memory.h"
 #include "parser.h"
+#include "profile.h"
+#include "vm_stats.h"
 #include "primitives.h"
 #include "safestd.h"
 #include "string.h"
@@ -30,15 +36,34 @@ enum input_mode {
  * - OUTPUT_INTERACTIVE / (default)
  * - OUTPUT_RUN / --run
  * - OUTPUT_BYTECODE / --compile
+ * - OUTPUT_C / --emit-c
+ * - OUTPUT_IMAGE / --save-image
  */
 enum output_mode {
     OUTPUT_INTERACTIVE,
     OUTPUT_RUN,
     OUTPUT_BYTECODE,
+    OUTPUT_C,
+    OUTPUT_IMAGE,
 };
 
 const char *input_prompt = ">>> ";
 
+/* -- load_input
+ * Loads an input file in the INPUT_BYTECODE mode, which is a Scheme file
+ * if `use_cache` is set. It is then loaded through the compilation cache
+ * if it's the `last` input file.
+ */
+static void load_input(const char *file_name, int use_cache, int last) {
+    if (use_cache) {
+        load_cached(file_name, last);
+        return;
+    }
+    FILE *f = s_fopen(file_name, "rb");
+    load_insts(f);
+    fclose(f);
+}
+
 int main(int argc, char **argv) {
     enum input_mode input_mode = INPUT_INTERACTIVE;
     enum output_mode output_mode = OUTPUT_INTERACTIVE;
@@ -46,7 +71,13 @@ int main(int argc, char **argv) {
     uint32_t input_file_names_capacity = 4;
     char **input_file_names = s_malloc(input_file_names_capacity * sizeof(char *));
     char *output_file_name = NULL;
+    char *profile_file_name = NULL;
+    char *image_file_name = NULL;
     int show_bytecode = 0;
+    int gc_stats = 0;
+    int alloc_profile = 0;
+    int show_vm_stats = 0;
+    int use_cache = 1;
 
     for (char **p = argv + 1; *p != NULL; p++) {
         char *arg = *p;
@@ -78,8 +109,70 @@ int main(int argc, char **argv) {
                 return 1;
             }
             output_file_name = arg;
+        } else if (strcmp(arg, "--emit-c") == 0) {
+            if (output_mode != OUTPUT_INTERACTIVE) {
+                eprintf("Error: multiple output modes specified\n");
+                return 1;
+            }
+            output_mode = OUTPUT_C;
+            arg = *++p;
+            if (arg == NULL || strncmp(arg, "--", 2) == 0) {
+                eprintf("Error: no filename provided for --emit-c option\n");
+                return 1;
+            }
+            if (output_file_name != NULL) {
+                eprintf("Error: multiple output files specified\n");
+                return 1;
+            }
+            output_file_name = arg;
+        } else if (strcmp(arg, "--save-image") == 0) {
+            if (output_mode != OUTPUT_INTERACTIVE) {
+                eprintf("Error: multiple output modes specified\n");
+                return 1;
+            }
+            output_mode = OUTPUT_IMAGE;
+            arg = *++p;
+            if (arg == NULL || strncmp(arg, "--", 2) == 0) {
+                eprintf("Error: no filename provided for --save-image option\n");
+                return 1;
+            }
+            if (output_file_name != NULL) {
+                eprintf("Error: multiple output files specified\n");
+                return 1;
+            }
+            output_file_name = arg;
+        } else if (strcmp(arg, "--image") == 0) {
+            arg = *++p;
+            if (arg == NULL || strncmp(arg, "--", 2) == 0) {
+                eprintf("Error: no filename provided for --image option\n");
+                return 1;
+            }
+            image_file_name = arg;
+        } else if (strcmp(arg, "--no-cache") == 0) {
+            use_cache = 0;
         } else if (strcmp(arg, "--show-bytecode") == 0) {
             show_bytecode = 1;
+        } else if (strcmp(arg, "--profile") == 0) {
+            arg = *++p;
+            if (arg == NULL || strncmp(arg, "--", 2) == 0) {
+                eprintf("Error: no filename provided for --profile option\n");
+                return 1;
+            }
+            profile_file_name = arg;
+        } else if (strcmp(arg, "--gc-stats") == 0) {
+            gc_stats = 1;
+        } else if (strcmp(arg, "--vm-stats") == 0) {
+#ifndef VM_STATS
+            eprintf("Error: --vm-stats requires the interpreter to be compiled with VM_STATS\n");
+            return 1;
+#endif
+            show_vm_stats = 1;
+        } else if (strcmp(arg, "--alloc-profile") == 0) {
+#ifndef ALLOC_PROFILE
+            eprintf("Error: --alloc-profile requires the interpreter to be compiled with ALLOC_PROFILE\n");
+            return 1;
+#endif
+            alloc_profile = 1;
         } else if (strncmp(arg, "--", 2) == 0) {
             eprintf("Error: invalid command-line option %s\n", arg);
             return 1;
@@ -99,18 +192,52 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    // the cache is only used to run Scheme files, and not when source positions are needed,
+    // or when saving an image, which needs the macros defined by compiling them
+    if (input_mode != INPUT_FILE || output_mode == OUTPUT_BYTECODE || output_mode == OUTPUT_C
+            || output_mode == OUTPUT_IMAGE || show_bytecode || profile_file_name != NULL || alloc_profile)
+        use_cache = 0;
+    // Scheme files are then loaded like bytecode files
+    if (use_cache)
+        input_mode = INPUT_BYTECODE;
+
+#ifdef AOT
+    // without input files, the program translated by --emit-c is run
+    if (input_mode == INPUT_INTERACTIVE) {
+        input_mode = INPUT_BYTECODE;
+        if (output_mode == OUTPUT_INTERACTIVE)
+            output_mode = OUTPUT_RUN;
+    }
+#endif
+
     setup_memory();
+    // printed at exit, since the program may exit from within a primitive
+    if (gc_stats)
+        atexit(print_gc_stats);
+    if (alloc_profile)
+        atexit(print_alloc_profile);
+    if (show_vm_stats)
+        atexit(print_vm_stats);
     setup_obarray();
     setup_primitives();
     execution_env = make_global_env(1, 0);
     compiler_env = make_global_env(1, 1);
     setup_insts();
-    setup_env();
+    if (image_file_name != NULL) {
+        load_image(image_file_name);
+        if (use_cache)
+            cache_add_image(image_file_name);
+    } else {
+        load_compiler();
+        setup_env();
+    }
+    if (profile_file_name != NULL)
+        start_profile(profile_file_name);
 
     uint32_t file = 0;
     uint32_t program = this_inst();
     uint32_t expr;
-    FILE *input_file;
+    FILE *input_file = NULL;
 
     if (output_mode == OUTPUT_INTERACTIVE && input_mode == INPUT_INTERACTIVE)
         printf("%s", input_prompt);
@@ -120,34 +247,44 @@ int main(int argc, char **argv) {
         break;
     case INPUT_FILE:
         input_file = s_fopen(input_file_names[file++], "r");
+        parser_set_source(input_file, input_file_names[file - 1]);
         break;
     case INPUT_BYTECODE:
-        input_file = s_fopen(input_file_names[file++], "rb");
+#ifdef AOT
+        if (input_files_num == 0) {
+            expr = this_inst() - 1;
+            load_bytecode(aot_bytecode, aot_bytecode_size, 0);
+            aot_register(expr + 1);
+            break;
+        }
+#endif
         expr = this_inst() - 1;
-        load_insts(input_file);
+        file++;
+        load_input(input_file_names[file - 1], use_cache, file == input_files_num);
         break;
     }
 
     while (1) {
         switch (input_mode) {
         case INPUT_INTERACTIVE:
-            expr = read_expr(stdin);
+            // --save-image without input files saves the image right away
+            expr = output_mode == OUTPUT_IMAGE ? UINT32_MAX : read_expr(stdin);
             break;
         case INPUT_FILE:
             expr = read_expr(input_file);
             while (expr == UINT32_MAX && file != input_files_num) {
                 fclose(input_file);
                 input_file = s_fopen(input_file_names[file++], "r");
+                parser_set_source(input_file, input_file_names[file - 1]);
                 expr = read_expr(input_file);
             }
             break;
         case INPUT_BYTECODE:
             expr = next_expr(expr + 1);
             while (insts[expr].type == INST_EOF && file != input_files_num) {
-                fclose(input_file);
-                input_file = s_fopen(input_file_names[file++], "rb");
                 expr = this_inst();
-                load_insts(input_file);
+                file++;
+                load_input(input_file_names[file - 1], use_cache, file == input_files_num);
             }
             if (insts[expr].type == INST_EOF)
                 expr = UINT32_MAX;
@@ -159,6 +296,7 @@ int main(int argc, char **argv) {
 
         if (show_bytecode) {
             uint32_t end = this_inst();
+            load_lazy_lambdas(expr, end);
             for (uint32_t inst = expr; inst < end; inst++)
                 print_inst(inst);
         }
@@ -175,22 +313,29 @@ int main(int argc, char **argv) {
             break;
         }
         case OUTPUT_RUN:
+        case OUTPUT_IMAGE:
             exec(expr, execution_env);
             break;
         case OUTPUT_BYTECODE:
+        case OUTPUT_C:
             break;
         }
     }
 
-    if (input_mode != INPUT_INTERACTIVE)
+    if (input_file != NULL)
         fclose(input_file);
 
-    if (output_mode == OUTPUT_BYTECODE) {
-        FILE *output_file = s_fopen(output_file_name, "wb");
+    if (output_mode == OUTPUT_BYTECODE || output_mode == OUTPUT_C) {
+        FILE *output_file = s_fopen(output_file_name, output_mode == OUTPUT_C ? "w" : "wb");
         uint32_t end = this_inst();
         if (input_mode == INPUT_BYTECODE)
             end--;
-        save_insts(output_file, program, end);
+        if (output_mode == OUTPUT_C)
+            emit_c(output_file, program, end);
+        else
+            save_insts(output_file, program, end);
+    } else if (output_mode == OUTPUT_IMAGE) {
+        save_image(s_fopen(output_file_name, "wb"));
     } else if (input_mode == INPUT_INTERACTIVE) {
         putchar('\n');
     }
@@ -2,88 +2,245 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 
 #include "memory.h"
+#include "alloc_profile.h"
 #include "types.h"
 #include "env.h"
 #include "exec.h"
 #include "exec_gc.h"
 #include "safestd.h"
 
+#ifndef NURSERY_SIZE
+#define NURSERY_SIZE 262144
+#endif
+
+#ifndef LARGE_OBJECT_SIZE
+#define LARGE_OBJECT_SIZE 65536
+#endif
+
+#define MIN_MEM_SIZE 2097152
+
+/* == Generations
+ * The heap is split into two generations. New objects are allocated in the
+ * nursery, a fixed-size region of NURSERY_SIZE bytes. When it fills up,
+ * a minor collection copies the objects in it which are still alive into
+ * the old generation, after which the nursery is empty again. Since most
+ * objects die young, this is cheap, and long-lived objects, such as the
+ * ones reachable from the global environments, are not copied again.
+ *
+ * The old generation is only collected by a major collection, which copies
+ * all live objects of both generations into a new old generation. A major
+ * collection happens when the old generation may not have room for the
+ * objects promoted by a minor collection.
+ *
+ * Objects of at least LARGE_OBJECT_SIZE bytes, or larger than the nursery, are
+ * allocated in the large object space instead, where they are never moved.
+ *
+ * The old generation consists of two semispaces mapped with mmap, which are
+ * reused by all major collections, each of them copying the live objects from
+ * the current semispace into the spare one. Only the first `mem_size` bytes
+ * of the current semispace are used, or all of it, if it is smaller. After
+ * a collection, `mem_size` is doubled while at least half of it is taken up
+ * by live objects, and halved while less than an eighth of it is, down to
+ * MIN_MEM_SIZE. The spare semispace is mapped
+ * again whenever its size differs from `mem_size`, and the pages used by it
+ * before the collection are returned to the system with madvise, so that the
+ * memory taken up by a short-lived spike of allocations is released.
+ *
+ * Each object in the large object space is allocated separately and kept
+ * in the `large_objects` list. Instead of being copied, such objects are
+ * marked when reached during a major collection, and those left unmarked
+ * afterwards are freed. A major collection is also started once the size
+ * of large objects allocated since the previous one exceeds `mem_size`.
+ * The size of live large objects counts towards the resizing of `mem_size`,
+ * so that large objects which are still alive make major collections rarer.
+ */
+
+static char *nursery_start;
+static char *nursery_ptr;
+
 static char *mem_start;
-static size_t mem_size = 2097152;
+static size_t mem_mapped;
+static size_t mem_size = MIN_MEM_SIZE;
 static char *free_ptr;
 
-/* -- GC_object
- * Contains a pointer to a pointer which is to be updated.
+static char *spare_start = NULL;
+static size_t spare_mapped = 0;
+
+static size_t large_allocated = 0;
+static size_t large_live = 0;
+
+/* -- Header
+ * Precedes every object in garbage-collected memory other than a pair.
+ * `tag` is always TYPE_HEADER, while the first word of a pair is the type
+ * of its car, which can never be TYPE_HEADER, so the two can be told apart.
+ * `type` is the type of the object - TYPE_STRING, TYPE_VECTOR, TYPE_LAMBDA,
+ * or TYPE_ENV. Pairs have no header, since they make up most of the heap.
+ * `large` is set for objects in the large object space, which are marked
+ * instead of being moved, with `marked` indicating whether they were reached.
+ */
+typedef struct Header {
+    uint32_t tag;
+    uint8_t type;
+    uint8_t large;
+    uint8_t marked;
+} Header;
+
+/* -- Large_object
+ * Contains an object in the large object space, which follows the header.
+ * `next` links all large objects, while `next_marked` links the objects
+ * which were marked during the current collection, but not yet scanned.
+ */
+typedef struct Large_object {
+    struct Large_object *next;
+    struct Large_object *next_marked;
+    size_t size;
+    Header header;
+} Large_object;
+
+static Large_object *large_objects = NULL;
+static Large_object *marked_objects = NULL;
+
+static GC_stats stats;
+
+/* -- Remembered
+ * The remembered set contains locations outside of the nursery which may
+ * contain pointers into it. Such pointers can only be created by modifying
+ * an existing object, so the locations are added by the write barrier.
+ * They are used as additional roots in minor collections.
+ * A location is either a value inside an object in the old generation
+ * (with `global` set to NULL), or a binding in a global environment,
+ * represented by its index, since the array of bindings may be reallocated.
+ *
+ * The set is a hash table with open addressing, so that a location stored
+ * to repeatedly is only remembered once. Otherwise, a loop storing young
+ * objects into an old one without allocating would grow it without bound,
+ * since it's only emptied by a collection. Empty entries have both fields
+ * set to NULL. The table is shrunk back to REMEMBERED_SET_SIZE entries
+ * after each collection.
  */
-typedef struct GC_object {
-    enum {
-        GC_VAL,
-        GC_ENV,
-    } type;
+typedef struct Remembered {
+    Global_env *global;
     union {
         Val *val;
-        Env **env;
+        uint32_t index;
     };
-} GC_object;
-
-static GC_object *gc_stack;
-static size_t gc_stack_size = 4096;
-static GC_object *gc_stack_ptr;
-
-static void gc_stack_push(GC_object obj) {
-    if (gc_stack_ptr == gc_stack + gc_stack_size) {
-        ptrdiff_t index = gc_stack_ptr - gc_stack;
-        gc_stack_size *= 2;
-        gc_stack = s_realloc(gc_stack, gc_stack_size * sizeof(GC_object));
-        gc_stack_ptr = gc_stack + index;
+} Remembered;
+
+#define REMEMBERED_SET_SIZE 1024
+
+static Remembered *remembered_set = NULL;
+static size_t remembered_set_size;
+static size_t remembered_num;
+
+static int remembered_eq(Remembered a, Remembered b) {
+    return a.global == b.global && (a.global == NULL ? a.val == b.val : a.index == b.index);
+}
+
+/* -- find_remembered
+ * Returns the entry of the remembered set holding `loc`,
+ * or the empty entry where it should be inserted.
+ */
+static Remembered *find_remembered(Remembered *set, size_t size, Remembered loc) {
+    uintptr_t key = loc.global == NULL ? (uintptr_t)loc.val : (uintptr_t)loc.global + loc.index;
+    for (size_t i = (size_t)((key >> 3) * 0x9E3779B97F4A7C15ULL >> 32) & (size - 1); ; i = (i + 1) & (size - 1))
+        if ((set[i].global == NULL && set[i].val == NULL) || remembered_eq(set[i], loc))
+            return &set[i];
+}
+
+/* -- clear_remembered_set
+ * Empties the remembered set, shrinking it back to its initial size.
+ */
+static void clear_remembered_set(void) {
+    if (remembered_set == NULL || remembered_set_size != REMEMBERED_SET_SIZE) {
+        free(remembered_set);
+        remembered_set_size = REMEMBERED_SET_SIZE;
+        remembered_set = s_malloc(remembered_set_size * sizeof(Remembered));
     }
-    *gc_stack_ptr++ = obj;
+    memset(remembered_set, 0, remembered_set_size * sizeof(Remembered));
+    remembered_num = 0;
 }
 
-static GC_object gc_stack_pop(void) {
-    return *--gc_stack_ptr;
+static void remember(Remembered loc) {
+    Remembered *entry = find_remembered(remembered_set, remembered_set_size, loc);
+    if (entry->global != NULL || entry->val != NULL)
+        return;
+    *entry = loc;
+    if (2 * ++remembered_num <= remembered_set_size)
+        return;
+    Remembered *old_set = remembered_set;
+    size_t old_size = remembered_set_size;
+    remembered_set_size *= 2;
+    remembered_set = s_malloc(remembered_set_size * sizeof(Remembered));
+    memset(remembered_set, 0, remembered_set_size * sizeof(Remembered));
+    for (Remembered *old = old_set; old < old_set + old_size; old++)
+        if (old->global != NULL || old->val != NULL)
+            *find_remembered(remembered_set, remembered_set_size, *old) = *old;
+    free(old_set);
+}
+
+static void update_heap_size(void) {
+    stats.heap_size = NURSERY_SIZE + mem_mapped + spare_mapped + large_live + large_allocated;
+    if (stats.heap_size > stats.peak_heap_size)
+        stats.peak_heap_size = stats.heap_size;
+}
+
+static char *map_space(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        eprintf("Error: out of memory\n");
+        exit(1);
+    }
+    return p;
 }
 
 void setup_memory(void) {
-    free_ptr = mem_start = s_malloc(mem_size);
-    gc_stack_ptr = gc_stack = s_malloc(gc_stack_size * sizeof(GC_object));
+    nursery_ptr = nursery_start = s_malloc(NURSERY_SIZE);
+    free_ptr = mem_start = map_space(mem_size);
+    mem_mapped = mem_size;
+    clear_remembered_set();
+    update_heap_size();
 }
 
-/* -- garbage_collect
- * Performs garbage collection and extends the heap size if more than half of it
- * is still taken up afterwards.
- *
- * The garbage collector is a simple stop-and-copy collector, which recursively
- * copies objects to the new memory, taking as a starting point the global
- * environment, evironments and values located on the stack, and `env_lock`.
+/* -- minor_collect, major_collect
+ * Perform a minor or major garbage collection. A major collection resizes
+ * the old generation depending on how much of it is still taken up afterwards.
  *
- * Unlike the garbage collector of SICP chapter 5.3.2, which uses a pointer that
- * sequentially scans all the copied cells, the copying here is performed
- * recursively, because memory constists of several data types, which can only
- * be known through the type of a pointer pointing to allocated data.
+ * The garbage collector is a stop-and-copy collector, which copies objects
+ * to the new memory, taking as a starting point the global environment,
+ * evironments and values located on the stack, and `env_lock`.
+ * A minor collection takes the remembered set as its starting point instead
+ * of the global environments, and only copies objects located in the nursery.
+ * Pointers to objects in the old generation are left unchanged and not followed.
  *
- * In order to avoid a limit on recursion, the garbage collector is written
- * iteratively and uses a heap-allocated stack.
+ * As in the garbage collector of SICP chapter 5.3.2, the copied objects are
+ * then scanned sequentially, moving the objects they point to, until the scan
+ * reaches `free_ptr`. Since memory consists of several data types, each object
+ * other than a pair is preceded by a header containing its type.
+ * This way no memory other than the new heap is needed during collection.
  *
  * Each type of data is turned into a 'broken heart' after being moved to the
  * new heap.
- * +-----------+-------------------------------------+---------------------------+
- * | data type | conditon for broken heart           | field holding new address |
- * +-----------+-------------------------------------+---------------------------+
- * | Env       | env->size == UINT32_MAX             | env->outer                |
- * | Lambda    | lambda->body == UINT32_MAX          | lambda->new_ptr           |
- * | Pair      | pair->car.type == TYPE_BROKEN_HEART | pair->car.pair_data       |
- * | String    | str->chars[0] == UINT32_MAX         | str->new_ptr              |
- * +-----------+-------------------------------------+---------------------------+
+ * +-----------+----------------------------------------+---------------------------+
+ * | data type | conditon for broken heart              | field holding new address |
+ * +-----------+----------------------------------------+---------------------------+
+ * | Env       | env->size == UINT32_MAX                | env->outer                |
+ * | Lambda    | lambda->body == UINT32_MAX             | lambda->new_ptr           |
+ * | Pair      | pair->car.type == TYPE_BROKEN_HEART    | pair->car.pair_data       |
+ * | String    | str->chars[0] == UINT32_MAX            | str->new_ptr              |
+ * | Vector    | vec->vals[0].type == TYPE_BROKEN_HEART | vec->new_ptr              |
+ * +-----------+----------------------------------------+---------------------------+
  *
  * If a broken heart value is detected, the data has already been moved and the
  * moving function simply returns the address contained within it. Otherwise it
  * sets up the broken heart and copies data to the new address, determined by
  * the `free_ptr` pointer.
  */
-static void garbage_collect(void);
+static void minor_collect(void);
+static void major_collect(void);
 
 /* -- env_lock
  * A pointer to an environment pointer which will be modified when
@@ -103,35 +260,190 @@ static size_t align_size(size_t size) {
     return (size + 7) / 8 * 8;
 }
 
+static int in_nursery(void *ptr) {
+    return (char *)ptr >= nursery_start && (char *)ptr < nursery_start + NURSERY_SIZE;
+}
+
+/* -- in_stack
+ * Checks whether a pointer points into the stack, where the frames of lambdas
+ * with PARAMS_STACK_FRAME are kept. They are scanned as part of the stack.
+ */
+static int in_stack(void *ptr) {
+    return (Val *)ptr >= stack && (Val *)ptr < stack_ptr;
+}
+
+static int points_to_nursery(Val val) {
+    switch (val.type) {
+    case TYPE_STRING:
+        return in_nursery(val.string_data);
+    case TYPE_PAIR:
+        return in_nursery(val.pair_data);
+    case TYPE_VECTOR:
+        return in_nursery(val.vector_data);
+    case TYPE_LAMBDA:
+        return in_nursery(val.lambda_data);
+    case TYPE_ENV:
+        return in_nursery(val.env_data);
+    default:
+        return 0;
+    }
+}
+
+/* -- gc_write_barrier
+ * Must be called after a value is stored in an already existing object.
+ * `slot` is the location of the value inside the object.
+ */
+void gc_write_barrier(Val *slot) {
+    if (!in_nursery(slot) && !in_stack(slot) && points_to_nursery(*slot))
+        remember((Remembered){NULL, {.val = slot}});
+}
+
+/* -- gc_global_write_barrier
+ * Must be called after a value is stored in a binding of a global environment.
+ */
+void gc_global_write_barrier(Global_env *global, uint32_t index) {
+    if (points_to_nursery(global->bindings[index].val))
+        remember((Remembered){global, {.index = index}});
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* -- record_pause
+ * Records a collection which started at time `start` in the statistics.
+ */
+static void record_pause(uint64_t start) {
+    uint64_t pause = now_ns() - start;
+    stats.total_pause_ns += pause;
+    if (pause > stats.max_pause_ns)
+        stats.max_pause_ns = pause;
+    size_t bucket = 0;
+    for (uint64_t limit = 10000; bucket < GC_PAUSE_BUCKETS - 1 && pause >= limit; limit *= 10)
+        bucket++;
+    stats.pause_histogram[bucket]++;
+    update_heap_size();
+}
+
+GC_stats get_gc_stats(void) {
+    GC_stats current = stats;
+    current.bytes_allocated += (uint64_t)(nursery_ptr - nursery_start);
+    return current;
+}
+
+void print_gc_stats(void) {
+    GC_stats current = get_gc_stats();
+    fflush(stdout);
+    eprintf("GC statistics:\n");
+    eprintf("  minor collections: %"PRIu64"\n", current.minor_collections);
+    eprintf("  major collections: %"PRIu64"\n", current.major_collections);
+    eprintf("  bytes allocated: %"PRIu64"\n", current.bytes_allocated);
+    eprintf("  bytes copied: %"PRIu64"\n", current.bytes_copied);
+    eprintf("  heap size: %"PRIu64" (peak %"PRIu64")\n", current.heap_size, current.peak_heap_size);
+    eprintf("  heap growths: %"PRIu64", shrinks: %"PRIu64"\n", current.heap_growths, current.heap_shrinks);
+    eprintf("  total pause: %.3f ms, longest pause: %.3f ms\n",
+            (double)current.total_pause_ns / 1e6, (double)current.max_pause_ns / 1e6);
+    static const char *bucket_names[GC_PAUSE_BUCKETS] = {"<10us", "<100us", "<1ms", "<10ms", "<100ms", ">=100ms"};
+    eprintf("  pauses:");
+    for (size_t i = 0; i < GC_PAUSE_BUCKETS; i++)
+        eprintf(" %s: %"PRIu64, bucket_names[i], current.pause_histogram[i]);
+    eprintf("\n");
+}
+
+/* -- alloc_large
+ * Allocates an object in the large object space after a minor collection.
+ * Because of that collection, the values the object is then initialized with
+ * cannot point into the nursery, so the write barrier is not needed for the
+ * initialization.
+ */
+static void *alloc_large(Type type, size_t size) {
+    if (large_allocated > mem_size)
+        major_collect();
+    else
+        minor_collect();
+    large_allocated += size;
+    stats.bytes_allocated += size;
+    Large_object *large = s_malloc(sizeof(Large_object) + size);
+    large->next = large_objects;
+    large->size = size;
+    large->header = (Header){TYPE_HEADER, (uint8_t)type, 1, 0};
+    large_objects = large;
+    update_heap_size();
+    return large + 1;
+}
+
 /* -- gc_alloc
- * Allocates a given amount of memory and returns its address, possibly
- * invoking the garbage collector.
+ * Allocates memory for an object of a given type and size and returns its
+ * address, possibly invoking the garbage collector. Objects other than pairs
+ * are preceded by a header.
  */
-void *gc_alloc(size_t size) {
+void *gc_alloc(Type type, size_t size) {
     size = align_size(size);
+#ifdef ALLOC_PROFILE
+    record_alloc(type, type == TYPE_PAIR ? size : size + sizeof(Header));
+#endif
+    if (type == TYPE_PAIR) {
 #ifndef GC_ALWAYS
-    if (free_ptr - mem_start >= (ptrdiff_t)mem_size - (ptrdiff_t)size)
+        if (nursery_ptr - nursery_start > NURSERY_SIZE - (ptrdiff_t)size)
 #endif
-        garbage_collect();
-    if (free_ptr - mem_start >= (ptrdiff_t)mem_size - (ptrdiff_t)size) {
-        mem_size *= 2;
-        while (free_ptr - mem_start >= (ptrdiff_t)mem_size - (ptrdiff_t)size)
-            mem_size *= 2;
-        garbage_collect();
+            minor_collect();
+        nursery_ptr += size;
+        return nursery_ptr - size;
     }
-    free_ptr += size;
-    return free_ptr - size;
+    if (size >= LARGE_OBJECT_SIZE || size + sizeof(Header) > NURSERY_SIZE)
+        return alloc_large(type, size);
+    size += sizeof(Header);
+#ifndef GC_ALWAYS
+    if (nursery_ptr - nursery_start > NURSERY_SIZE - (ptrdiff_t)size)
+#endif
+        minor_collect();
+    Header *header = (Header *)nursery_ptr;
+    *header = (Header){TYPE_HEADER, (uint8_t)type, 0, 0};
+    nursery_ptr += size;
+    return header + 1;
 }
 
 /* -- force_alloc
- * Allocates a given amount of memory and returns its address without checking
- * whether it can be allocated. It is used only inside the garbage collector,
- * as it's impossible to run out of memory there.
+ * Allocates memory for an object in the old generation and returns its
+ * address without checking whether it can be allocated. It is used only
+ * inside the garbage collector, as it's impossible to run out of memory there.
  */
-static void *force_alloc(size_t size) {
-    size = align_size(size);
-    free_ptr += size;
-    return free_ptr - size;
+static void *force_alloc(Type type, size_t size) {
+    char *ptr = free_ptr;
+    free_ptr += align_size(size);
+    if (type == TYPE_PAIR)
+        return ptr;
+    *(Header *)ptr = (Header){TYPE_HEADER, (uint8_t)type, 0, 0};
+    free_ptr += sizeof(Header);
+    return ptr + sizeof(Header);
+}
+
+/* -- collecting_minor
+ * Set during minor collections, which only move objects in the nursery.
+ */
+static int collecting_minor = 0;
+
+static int is_moved(void *ptr) {
+    return !collecting_minor || in_nursery(ptr);
+}
+
+/* -- is_large
+ * Checks whether an object other than a pair is in the large object space.
+ * If it is, the object is marked, and added to the list of objects to scan
+ * if it wasn't marked already.
+ */
+static int is_large(void *obj) {
+    if (!((Header *)obj - 1)->large)
+        return 0;
+    Large_object *large = (Large_object *)obj - 1;
+    if (!large->header.marked) {
+        large->header.marked = 1;
+        large->next_marked = marked_objects;
+        marked_objects = large;
+    }
+    return 1;
 }
 
 static Val move_val(Val val);
@@ -141,36 +453,183 @@ static Env *move_env(Env *env);
 static Pair *move_pair(Pair *pair);
 static Lambda *move_lambda(Lambda *lambda);
 
-static void garbage_collect(void) {
-    void *new_mem = s_malloc(mem_size);
-    free_ptr = new_mem;
-    for (Binding *bind_ptr = execution_env->bindings; bind_ptr < execution_env->bindings + execution_env->size; bind_ptr++)
-        gc_stack_push((GC_object){GC_VAL, {.val = &bind_ptr->val}});
-    for (Binding *bind_ptr = compiler_env->bindings; bind_ptr < compiler_env->bindings + compiler_env->size; bind_ptr++)
-        gc_stack_push((GC_object){GC_VAL, {.val = &bind_ptr->val}});
+static size_t string_size(String *str) {
+    return sizeof(String) + (str->len ? str->len : 1) * sizeof(char32_t);
+}
+
+static size_t vector_size(Vector *vec) {
+    return sizeof(Vector) + (vec->len ? vec->len : 1) * sizeof(Val);
+}
+
+static size_t env_size(Env *env) {
+    return sizeof(Env) + env->size * sizeof(Val);
+}
+
+static void move_common_roots(void) {
     for (Val *val_ptr = stack; val_ptr < stack_ptr; val_ptr++)
-        gc_stack_push((GC_object){GC_VAL, {.val = val_ptr}});
-    gc_stack_push((GC_object){GC_ENV, {.env = &exec_env}});
+        *val_ptr = move_val(*val_ptr);
+    exec_env = move_env(exec_env);
     if (env_lock != NULL)
-        gc_stack_push((GC_object){GC_ENV, {.env = env_lock}});
-    while (gc_stack_ptr != gc_stack) {
-        GC_object obj = gc_stack_pop();
-        switch (obj.type) {
-        case GC_VAL:
-            *obj.val = move_val(*obj.val);
-            break;
-        case GC_ENV:
-            *obj.env = move_env(*obj.env);
-            break;
+        *env_lock = move_env(*env_lock);
+}
+
+/* -- scan_object
+ * Moves the objects pointed to by an object of a given type, returning
+ * the size of the object.
+ */
+static size_t scan_object(Type type, void *obj) {
+    switch (type) {
+    case TYPE_STRING:
+        return string_size(obj);
+    case TYPE_VECTOR: {
+        Vector *vec = obj;
+        for (size_t i = 0; i < vec->len; i++)
+            vec->vals[i] = move_val(vec->vals[i]);
+        return vector_size(vec);
+    }
+    case TYPE_LAMBDA: {
+        Lambda *lambda = obj;
+        lambda->env = move_env(lambda->env);
+        return sizeof(Lambda);
+    }
+    case TYPE_ENV: {
+        Env *env = obj;
+        env->outer = move_env(env->outer);
+        for (size_t i = 0; i < env->size; i++)
+            env->vals[i] = move_val(env->vals[i]);
+        return env_size(env);
+    }
+    default:
+        eprintf("Error: invalid object header in garbage-collected memory\n");
+        exit(1);
+    }
+}
+
+/* -- scan_objects
+ * Scans the objects copied to the old generation, starting from `scan`,
+ * and the marked large objects, moving the objects they point to,
+ * until no more objects are copied or marked.
+ */
+static void scan_objects(char *scan) {
+    while (1) {
+        if (scan < free_ptr) {
+            Header *header = (Header *)scan;
+            if (header->tag != TYPE_HEADER) {
+                Pair *pair = (Pair *)scan;
+                pair->car = move_val(pair->car);
+                pair->cdr = move_val(pair->cdr);
+                scan += align_size(sizeof(Pair));
+            } else {
+                scan += sizeof(Header) + align_size(scan_object(header->type, header + 1));
+            }
+        } else if (marked_objects != NULL) {
+            Large_object *large = marked_objects;
+            marked_objects = large->next_marked;
+            scan_object(large->header.type, large + 1);
+        } else {
+            return;
         }
     }
-    free(mem_start);
-    mem_start = new_mem;
-    // TODO leave extension for later
-    if (free_ptr - mem_start >= mem_size / 2) {
+}
+
+/* -- sweep_large
+ * Frees the large objects which were not marked during a major collection
+ * and unmarks the remaining ones.
+ */
+static void sweep_large(void) {
+    large_live = 0;
+    Large_object **large_ptr = &large_objects;
+    while (*large_ptr != NULL) {
+        Large_object *large = *large_ptr;
+        if (large->header.marked) {
+            large->header.marked = 0;
+            large_live += large->size;
+            large_ptr = &large->next;
+        } else {
+            *large_ptr = large->next;
+            free(large);
+        }
+    }
+    large_allocated = 0;
+}
+
+static void minor_collect(void) {
+#ifdef GC_ALWAYS
+    // alternate between minor and major collections
+    static int major = 0;
+    if ((major = !major)) {
+        major_collect();
+        return;
+    }
+#endif
+    size_t mem_limit = mem_size < mem_mapped ? mem_size : mem_mapped;
+    if (free_ptr - mem_start > (ptrdiff_t)mem_limit - (nursery_ptr - nursery_start)) {
+        major_collect();
+        return;
+    }
+    uint64_t start = now_ns();
+    stats.minor_collections++;
+    stats.bytes_allocated += (uint64_t)(nursery_ptr - nursery_start);
+    collecting_minor = 1;
+    char *scan = free_ptr;
+    move_common_roots();
+    for (Remembered *loc = remembered_set; loc < remembered_set + remembered_set_size; loc++) {
+        if (loc->global == NULL && loc->val == NULL)
+            continue;
+        Val *val = loc->global == NULL ? loc->val : &loc->global->bindings[loc->index].val;
+        *val = move_val(*val);
+    }
+    scan_objects(scan);
+    collecting_minor = 0;
+    stats.bytes_copied += (uint64_t)(free_ptr - scan);
+    clear_remembered_set();
+    nursery_ptr = nursery_start;
+    record_pause(start);
+}
+
+static void major_collect(void) {
+    uint64_t start = now_ns();
+    stats.major_collections++;
+    stats.bytes_allocated += (uint64_t)(nursery_ptr - nursery_start);
+    size_t old_size = mem_size;
+    // the live objects of both generations must fit in the new space
+    while ((size_t)((free_ptr - mem_start) + (nursery_ptr - nursery_start)) > mem_size)
         mem_size *= 2;
-        garbage_collect();
+    if (spare_mapped != mem_size) {
+        if (spare_start != NULL)
+            munmap(spare_start, spare_mapped);
+        spare_start = map_space(mem_size);
+        spare_mapped = mem_size;
     }
+    char *old_start = mem_start;
+    size_t old_mapped = mem_mapped;
+    size_t old_used = (size_t)(free_ptr - mem_start);
+    free_ptr = mem_start = spare_start;
+    mem_mapped = spare_mapped;
+    for (Binding *bind_ptr = execution_env->bindings; bind_ptr < execution_env->bindings + execution_env->size; bind_ptr++)
+        bind_ptr->val = move_val(bind_ptr->val);
+    for (Binding *bind_ptr = compiler_env->bindings; bind_ptr < compiler_env->bindings + compiler_env->size; bind_ptr++)
+        bind_ptr->val = move_val(bind_ptr->val);
+    move_common_roots();
+    scan_objects(mem_start);
+    sweep_large();
+    stats.bytes_copied += (uint64_t)(free_ptr - mem_start);
+    spare_start = old_start;
+    spare_mapped = old_mapped;
+    madvise(spare_start, old_used, MADV_DONTNEED);
+    clear_remembered_set();
+    nursery_ptr = nursery_start;
+    // large objects are counted as well, as they are scanned by every major collection
+    size_t live = (size_t)(free_ptr - mem_start) + large_live;
+    while (live >= mem_size / 2)
+        mem_size *= 2;
+    while (mem_size > MIN_MEM_SIZE && live < mem_size / 8)
+        mem_size /= 2;
+    if (mem_size > old_size)
+        stats.heap_growths++;
+    else if (mem_size < old_size)
+        stats.heap_shrinks++;
+    record_pause(start);
 }
 
 static Val move_val(Val val) {
@@ -196,63 +655,61 @@ static Val move_val(Val val) {
 }
 
 static String *move_string(String *str) {
+    if (!is_moved(str) || is_large(str))
+        return str;
     if (str->chars[0] == UINT32_MAX)
         return str->new_ptr;
-    size_t str_size = sizeof(String) + (str->len ? str->len : 1) * sizeof(char32_t);
-    String *new_str = force_alloc(str_size);
-    memcpy(new_str, str, str_size);
+    String *new_str = force_alloc(TYPE_STRING, string_size(str));
+    memcpy(new_str, str, string_size(str));
     str->chars[0] = UINT32_MAX;
     str->new_ptr = new_str;
     return new_str;
 }
 
 static Vector *move_vector(Vector *vec) {
+    if (!is_moved(vec) || is_large(vec))
+        return vec;
     if (vec->vals[0].type == TYPE_BROKEN_HEART)
         return vec->new_ptr;
-    size_t vec_size = sizeof(Vector) + (vec->len ? vec->len : 1) * sizeof(Val);
-    Vector *new_vec = force_alloc(vec_size);
-    memcpy(new_vec, vec, vec_size);
+    Vector *new_vec = force_alloc(TYPE_VECTOR, vector_size(vec));
+    memcpy(new_vec, vec, vector_size(vec));
     vec->vals[0].type = TYPE_BROKEN_HEART;
     vec->new_ptr = new_vec;
-    for (size_t i = 0; i < new_vec->len; i++)
-        gc_stack_push((GC_object){GC_VAL, {.val = &new_vec->vals[i]}});
     return new_vec;
 }
 
 static Env *move_env(Env *env) {
-    if (env == NULL)
+    if (env == NULL || in_stack(env) || !is_moved(env) || is_large(env))
         return env;
     if (env->size == UINT32_MAX)
         return env->outer;
-    Env *new_env = force_alloc(sizeof(Env) + env->size * sizeof(Val));
-    memcpy(new_env, env, sizeof(Env) + env->size * sizeof(Val));
+    Env *new_env = force_alloc(TYPE_ENV, env_size(env));
+    memcpy(new_env, env, env_size(env));
     env->size = UINT32_MAX;
     env->outer = new_env;
-    gc_stack_push((GC_object){GC_ENV, {.env = &new_env->outer}});
-    for (size_t i = 0; i < new_env->size; i++)
-        gc_stack_push((GC_object){GC_VAL, {.val = &new_env->vals[i]}});
     return new_env;
 }
 
 static Pair *move_pair(Pair *pair) {
+    if (!is_moved(pair))
+        return pair;
     if (pair->car.type == TYPE_BROKEN_HEART)
         return pair->car.pair_data;
-    Pair *new_pair = force_alloc(sizeof(Pair));
+    Pair *new_pair = force_alloc(TYPE_PAIR, sizeof(Pair));
     *new_pair = *pair;
     pair->car.type = TYPE_BROKEN_HEART;
     pair->car.pair_data = new_pair;
-    gc_stack_push((GC_object){GC_VAL, {.val = &new_pair->cdr}});
-    gc_stack_push((GC_object){GC_VAL, {.val = &new_pair->car}});
     return new_pair;
 }
 
 static Lambda *move_lambda(Lambda *lambda) {
+    if (!is_moved(lambda) || is_large(lambda))
+        return lambda;
     if (lambda->body == UINT32_MAX)
         return lambda->new_ptr;
-    Lambda *new_lambda = force_alloc(sizeof(Lambda));
+    Lambda *new_lambda = force_alloc(TYPE_LAMBDA, sizeof(Lambda));
     *new_lambda = *lambda;
     lambda->body = UINT32_MAX;
     lambda->new_ptr = new_lambda;
-    gc_stack_push((GC_object){GC_ENV, {.env = &new_lambda->env}});
     return new_lambda;
 }
@@ -1,6 +1,39 @@
 #include "types.h"
 
 void setup_memory(void);
-void *gc_alloc(size_t size);
+void *gc_alloc(Type type, size_t size);
 void gc_lock_env(Env **env_ptr);
 void gc_unlock_env(void);
+void gc_write_barrier(Val *slot);
+void gc_global_write_barrier(Global_env *global, uint32_t index);
+
+/* -- GC_stats
+ * Statistics collected by the garbage collector since the start of the program.
+ * - `bytes_allocated` is the total size of allocated objects, including the
+ *   objects in the nursery allocated since the last collection.
+ * - `bytes_copied` is the total size of objects copied by the collector.
+ * - `heap_size` is the current size of the heap, consisting of the nursery,
+ *   the two semispaces of the old generation and the large object space,
+ *   and `peak_heap_size` is the largest it has been.
+ * - `pause_histogram` contains the number of collections which took less
+ *   than 10 us, 100 us, 1 ms, 10 ms, 100 ms, and the remaining ones.
+ */
+
+#define GC_PAUSE_BUCKETS 6
+
+typedef struct GC_stats {
+    uint64_t minor_collections;
+    uint64_t major_collections;
+    uint64_t bytes_allocated;
+    uint64_t bytes_copied;
+    uint64_t heap_growths;
+    uint64_t heap_shrinks;
+    uint64_t heap_size;
+    uint64_t peak_heap_size;
+    uint64_t total_pause_ns;
+    uint64_t max_pause_ns;
+    uint64_t pause_histogram[GC_PAUSE_BUCKETS];
+} GC_stats;
+
+GC_stats get_gc_stats(void);
+void print_gc_stats(void);
@@ -1,11 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "parser.h"
 #include "types.h"
 #include "env.h"
 #include "exec.h"
+#include "exec_stack.h"
 #include "insts.h"
 #include "memory.h"
 #include "primitives/number.h"
@@ -14,230 +17,637 @@
 #include "string.h"
 #include "unicode/unicode.h"
 
-#define INIT_TOKEN_LENGTH 16
+#if defined(__SSE2__) && !defined(NO_SIMD)
+#include <emmintrin.h>
+#define PARSER_SIMD
+#endif
 
-/* -- parser_buffer
- * A buffer necessary to provide one Unicode character of pushback.
- * A value of UINT32_MAX represents the buffer as empty.
+#ifndef INPUT_BUFFER_SIZE
+#define INPUT_BUFFER_SIZE 65536
+#endif
+
+/* == Input
+ * The parser reads a file through an Input, which holds its bytes in memory.
+ * A regular file is mapped into memory as a whole, and other files, such as
+ * pipes and terminals, are read into `buffer` a line at a time, so that an
+ * expression typed in is read as soon as its line is complete.
+ * The bytes from `ptr` to `end` haven't been read yet. Reading more into
+ * the buffer keeps the bytes from `mark` on, if it's set, which the tokenizer
+ * uses to keep the name it's reading in one piece.
+ *
+ * Whitespace, comments and names consisting of ASCII characters are scanned
+ * a block of bytes at a time, and the names are interned without being copied.
+ * Any other characters are decoded from UTF-8 one at a time.
+ *
+ * An Input is created the first time its file is read, and freed when
+ * the parser reaches the end of the file.
+ */
+
+typedef struct Input {
+    FILE *file;
+    const unsigned char *ptr;
+    const unsigned char *end;
+    const unsigned char *mark;
+    unsigned char *buffer;
+    size_t buffer_size;
+    void *map;
+    size_t map_size;
+    int eof;
+    // the number of the line at `line_ptr`, up to which lines were counted
+    const unsigned char *line_ptr;
+    uint32_t line;
+    struct Input *next;
+} Input;
+
+static Input *inputs = NULL;
+
+/* -- source_file
+ * The source file being read, whose name is `source_name`. It is used to
+ * record the source positions of top-level expressions.
  */
-static char32_t parser_buffer = UINT32_MAX;
+static FILE *source_file = NULL;
+static const char *source_name;
 
-/* -- parser_fgetc32
- * Gets the next character from a file, using the parser buffer if it's full.
+/* -- scratch
+ * Holds the characters of a string literal or a non-ASCII name being read.
  */
-int32_t parser_fgetc32(FILE *f) {
-    if (parser_buffer != UINT32_MAX) {
-        int32_t c = (int32_t)parser_buffer;
-        parser_buffer = UINT32_MAX;
-        return c;
+static char32_t *scratch = NULL;
+static size_t scratch_size = 0;
+
+static void scratch_put(size_t i, char32_t c) {
+    if (i >= scratch_size) {
+        scratch_size = scratch_size ? 2 * scratch_size : 64;
+        scratch = s_realloc(scratch, scratch_size * sizeof(char32_t));
     }
-    return s_fgetc32(f);
+    scratch[i] = c;
 }
 
-/* -- parser_fgetc32_nospace
- * Gets the next character from a file, skipping whitespace and comments.
- * Uses the parser buffer.
+/* -- parser_set_source
+ * Sets the file which is read from as a source file named `name`.
  */
-int32_t parser_fgetc32_nospace(FILE *f) {
-    int32_t c;
+void parser_set_source(FILE *f, const char *name) {
+    source_file = f;
+    source_name = name;
+}
+
+/* -- get_input
+ * Returns the Input of `f`, creating it if it doesn't exist yet.
+ */
+static Input *get_input(FILE *f) {
+    for (Input *in = inputs; in != NULL; in = in->next)
+        if (in->file == f)
+            return in;
+    Input *in = s_malloc(sizeof(Input));
+    *in = (Input){f, NULL, NULL, NULL, NULL, 0, NULL, 0, 0, NULL, 1, inputs};
+    inputs = in;
+
+    struct stat st;
+    int fd = fileno(f);
+    off_t pos = fd >= 0 ? ftello(f) : -1;
+    if (pos >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > pos) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            in->map = map;
+            in->map_size = (size_t)st.st_size;
+            in->ptr = (const unsigned char *)map + pos;
+            in->end = (const unsigned char *)map + st.st_size;
+            in->eof = 1;
+        }
+    }
+    if (in->map == NULL) {
+        in->buffer_size = INPUT_BUFFER_SIZE;
+        in->buffer = s_malloc(in->buffer_size);
+        in->ptr = in->end = in->buffer;
+    }
+    in->line_ptr = in->ptr;
+    return in;
+}
+
+static void free_input(Input *in) {
+    Input **link = &inputs;
+    while (*link != in)
+        link = &(*link)->next;
+    *link = in->next;
+    if (in->map != NULL)
+        munmap(in->map, in->map_size);
+    free(in->buffer);
+    free(in);
+}
+
+/* -- input_line
+ * Returns the number of the line the Input is at.
+ */
+static uint32_t input_line(Input *in) {
+    const unsigned char *p = in->line_ptr;
+    while ((p = memchr(p, '\n', (size_t)(in->ptr - p))) != NULL) {
+        in->line++;
+        p++;
+    }
+    in->line_ptr = in->ptr;
+    return in->line;
+}
+
+/* -- input_fill
+ * Reads more bytes of the file into the buffer. Returns 0 if there are none.
+ */
+static int input_fill(Input *in) {
+    if (in->eof)
+        return 0;
+    input_line(in);
+    const unsigned char *keep = in->mark != NULL ? in->mark : in->ptr;
+    size_t kept = (size_t)(in->end - keep);
+    memmove(in->buffer, keep, kept);
+    if (kept == in->buffer_size) {
+        in->buffer_size *= 2;
+        in->buffer = s_realloc(in->buffer, in->buffer_size);
+    }
+    in->ptr = in->buffer + (in->ptr - keep);
+    in->line_ptr = in->ptr;
+    if (in->mark != NULL)
+        in->mark = in->buffer;
+    in->end = in->buffer + kept;
+
+    unsigned char *p = in->buffer + kept;
+    unsigned char *limit = in->buffer + in->buffer_size;
+    int c = 0;
+    while (p < limit && c != '\n' && (c = getc_unlocked(in->file)) != EOF)
+        *p++ = (unsigned char)c;
+    if (c == EOF && ferror(in->file)) {
+        eprintf("Error: could not read file\n");
+        exit(1);
+    }
+    if (p == in->end) {
+        in->eof = 1;
+        return 0;
+    }
+    in->end = p;
+    return 1;
+}
+
+static int input_byte(Input *in) {
+    if (in->ptr == in->end && !input_fill(in))
+        return EOF;
+    return *in->ptr++;
+}
+
+/* -- input_getc32
+ * Reads the next character, decoding it from UTF-8. Returns EOF32 at the end.
+ */
+static int32_t input_getc32(Input *in) {
+    if (in->ptr < in->end && *in->ptr < 0x80)
+        return *in->ptr++;
+    int b0 = input_byte(in);
+    if (b0 == EOF)
+        return EOF32;
+    if (b0 < 0x80)
+        return b0;
+    int len = (b0 & 0xE0) == 0xC0 ? 2 : (b0 & 0xF0) == 0xE0 ? 3 : (b0 & 0xF8) == 0xF0 ? 4 : 0;
+    int32_t c = b0 & (0x7F >> len);
+    for (int i = 1; i < len; i++) {
+        int b = input_byte(in);
+        if (b == EOF || (b & 0xC0) != 0x80)
+            len = 0;
+        c = (c << 6) | (b & 0x3F);
+    }
+    if (len == 0 || (len == 2 && c < 0x80) || (len == 3 && (c < 0x800 || (0xD800 <= c && c <= 0xDFFF)))
+            || (len == 4 && (c < 0x10000 || c > 0x10FFFF))) {
+        eprintf("Error: invalid UTF-8 input\n");
+        exit(1);
+    }
+    return c;
+}
+
+/* -- skip_ascii_space
+ * Returns the first byte from `p` which isn't ASCII whitespace or a control
+ * character, or `end`.
+ */
+static const unsigned char *skip_ascii_space(const unsigned char *p, const unsigned char *end) {
+#ifdef PARSER_SIMD
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i del = _mm_set1_epi8(0x7F);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i is_space = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, space), v), _mm_cmpeq_epi8(v, del));
+        unsigned mask = ~(unsigned)_mm_movemask_epi8(is_space) & 0xFFFF;
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+    while (p < end && (*p <= ' ' || *p == 0x7F))
+        p++;
+    return p;
+}
+
+static int is_ascii_delimiter(unsigned char c) {
+    return c <= ' ' || c == 0x7F || c == ';' || c == '(' || c == ')' || c == '\'' || c == '"';
+}
+
+/* -- scan_ascii_name
+ * Returns the first byte from `p` which ends a name or isn't ASCII, or `end`.
+ */
+static const unsigned char *scan_ascii_name(const unsigned char *p, const unsigned char *end) {
+#ifdef PARSER_SIMD
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        // bytes which aren't ASCII are negative as signed
+        __m128i stop = _mm_cmplt_epi8(v, _mm_set1_epi8(' ' + 1));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7F)));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8('(')));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8(')')));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+        unsigned mask = (unsigned)_mm_movemask_epi8(stop);
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+    while (p < end && *p < 0x80 && !is_ascii_delimiter(*p))
+        p++;
+    return p;
+}
+
+/* -- skip_space
+ * Skips whitespace and comments. Returns 0 if the end of the file is reached.
+ */
+static int skip_space(Input *in) {
     while (1) {
-        while ((c = parser_fgetc32(f)) != EOF32 && (is_whitespace((char32_t)c) || is_control((char32_t)c)))
-            ;
-        if (c == ';') {
-            while ((c = parser_fgetc32(f)) != '\n' && c != EOF32)
-                ;
+        in->ptr = skip_ascii_space(in->ptr, in->end);
+        if (in->ptr == in->end) {
+            if (!input_fill(in))
+                return 0;
             continue;
         }
-        break;
+        if (*in->ptr == ';') {
+            const unsigned char *newline;
+            while ((newline = memchr(in->ptr, '\n', (size_t)(in->end - in->ptr))) == NULL) {
+                in->ptr = in->end;
+                if (!input_fill(in))
+                    return 0;
+            }
+            in->ptr = newline + 1;
+            continue;
+        }
+        if (*in->ptr < 0x80)
+            return 1;
+        in->mark = in->ptr;
+        int32_t c = input_getc32(in);
+        if (!is_whitespace((char32_t)c) && !is_control((char32_t)c)) {
+            in->ptr = in->mark;
+            in->mark = NULL;
+            return 1;
+        }
+        in->mark = NULL;
     }
-    return c;
 }
 
 /* -- parser_init
  * Initializes the parser by and checking for EOF.
- * If there are non-whitespace, non-comment characters remaining, it returns 1
- * and puts the character back into the parser_buffer.
- * If EOF is reached instead, it returns 0.
+ * If there are non-whitespace, non-comment characters remaining, it returns 1.
+ * If EOF is reached instead, it returns 0 and frees the Input of the file.
  * This function should always be called before using the compiler.
  */
 int parser_init(FILE *f) {
-    int32_t c = parser_fgetc32_nospace(f);
-    if (c == EOF32)
-        return 0;
-    parser_buffer = (char32_t)c;
-    return 1;
+    Input *in = get_input(f);
+    if (skip_space(in))
+        return 1;
+    free_input(in);
+    return 0;
 }
 
-int strbuf_eq_cstr(size_t len, char32_t *chars, char *s) {
-    for (size_t i = 0; i < len; i++)
-        if (chars[i] != s[i] || s[i] == '\0')
-            return 0;
-    return s[len] == '\0';
+static int token_eq(const unsigned char *token, size_t size, const char *s) {
+    return strlen(s) == size && memcmp(token, s, size) == 0;
 }
 
-static String *new_string(size_t len, char32_t *chars) {
-    String *str = s_malloc(sizeof(String) + len * sizeof(char32_t));
-    str->len = len;
-    memcpy(str->chars, chars, len * sizeof(char32_t));
-    free(chars);
-    return str;
+static void unexpected_eof(void) {
+    eprintf("Error: unexpected end of file\n");
+    exit(1);
 }
 
-static String *new_gc_string(size_t len, char32_t *chars) {
-    String *str = gc_alloc_string(len);
-    memcpy(str->chars, chars, len * sizeof(char32_t));
-    free(chars);
+/* -- read_string
+ * Reads a string literal, whose opening '"' has been read.
+ */
+static String *read_string(Input *in) {
+    size_t i = 0;
+    int32_t c;
+    while ((c = input_getc32(in)) != '"') {
+        if (c == EOF32) {
+            eprintf("Syntax error: premature end of file - '\"' expected\n");
+            exit(1);
+        }
+        if (c == '\\') {
+            c = input_getc32(in);
+            if (c == EOF32) {
+                eprintf("Syntax error: premature end of file - '\"' expected\n");
+                exit(1);
+            }
+            if (c != '"' && c != '\\') {
+                eprintf("Syntax error: invalid escape sequence in string: \\");
+                fputc32((char32_t)c, stderr);
+                eprintf("\n");
+                exit(1);
+            }
+        }
+        scratch_put(i++, (char32_t)c);
+    }
+    String *str = s_malloc(sizeof(String) + i * sizeof(char32_t));
+    str->len = i;
+    if (i > 0)
+        memcpy(str->chars, scratch, i * sizeof(char32_t));
     return str;
 }
 
-/* -- get_token
- * Returns value of the literal for literal tokens, symbols for variable names,
- * the pair (token . <ASCII code>) for characters '(', ')', '\'', '.' and '#'.
- * Note that '.' and '#' are not considered separate tokens in all contexts.
+/* -- read_number
+ * Returns the value of the numeric literal `token`.
  */
-Val get_token(FILE *f) {
-    int32_t c = parser_fgetc32_nospace(f);
+static Val read_number(const unsigned char *token, size_t size) {
+    char *num = s_malloc(size + 1);
+    for (size_t j = 0; j < size; j++) {
+        if (('0' <= token[j] && token[j] <= '9') || token[j] == '+' || token[j] == '-' || token[j] == '.')
+            num[j] = (char)token[j];
+        else
+            goto invalid_num;
+    }
+    num[size] = '\0';
+    char *endptr;
+    long long int_val = strtoll(num, &endptr, 10);
+    if (*endptr == '\0') {
+        free(num);
+        return (Val){TYPE_INT, {.int_data = int_val}};
+    }
+    double float_val = strtod(num, &endptr);
+    if (*endptr == '\0') {
+        free(num);
+        return (Val){TYPE_FLOAT, {.float_data = float_val}};
+    }
+invalid_num:
+    free(num);
+    eprintf("Syntax error: incorrect numeric literal %.*s\n", (int)size, (const char *)token);
+    exit(1);
+}
 
-    if (c == EOF32) {
-        eprintf("Error: unexpected end of file\n");
-        exit(1);
+/* -- decode_name
+ * Decodes the characters of a name into `scratch`, returning their number.
+ * The name was checked to be valid UTF-8 while it was read.
+ */
+static size_t decode_name(const unsigned char *token, size_t size) {
+    size_t len = 0;
+    for (const unsigned char *p = token; p < token + size; len++) {
+        int n = *p < 0x80 ? 1 : *p >= 0xF0 ? 4 : *p >= 0xE0 ? 3 : 2;
+        char32_t c = n == 1 ? *p : (char32_t)(*p & (0x7F >> n));
+        for (int k = 1; k < n; k++)
+            c = (c << 6) | (p[k] & 0x3F);
+        scratch_put(len, c);
+        p += n;
     }
+    return len;
+}
+
+/* -- read_token
+ * Reads the next token, returning the ASCII code of the characters '(', ')',
+ * '\'', '.' and '#', and 0 for other tokens, whose value it stores in `val`:
+ * that of the literal for literal tokens, and a symbol for variable names.
+ * Note that '.' and '#' are not considered separate tokens in all contexts.
+ */
+static int read_token(Input *in, Val *val) {
+    if (!skip_space(in))
+        unexpected_eof();
 
     // simple cases
-    if (c == '(' || c == ')' || c == '\'') {
-        Pair *pair = gc_alloc(sizeof(Pair));
-        pair->car = (Val){TYPE_SYMBOL, {.string_data = new_interned_string_from_cstring("token")}};
-        pair->cdr = (Val){TYPE_INT, {.int_data = c}};
-        return (Val){TYPE_PAIR, {.pair_data = pair}};
+    unsigned char first = *in->ptr;
+    if (first == '(' || first == ')' || first == '\'') {
+        in->ptr++;
+        return first;
     }
 
-    size_t capacity = INIT_TOKEN_LENGTH;
-    char32_t *s = s_malloc(capacity * sizeof(char32_t));
-
     // string literal
-    if (c == '"') {
-        size_t i = 0;
-        while ((c = parser_fgetc32(f)) != '"') {
-            if (c == EOF32) {
-                eprintf("Syntax error: premature end of file - '\"' expected\n");
-                exit(1);
-            }
-            if (c == '\\') {
-                c = parser_fgetc32(f);
-                if (c == EOF32) {
-                    eprintf("Syntax error: premature end of file - '\"' expected\n");
-                    exit(1);
-                }
-                if (c != '"' && c != '\\') {
-                    eprintf("Syntax error: invalid escape sequence in string: \\");
-                    fputc32((char32_t)c, stderr);
-                    eprintf("\n");
-                    exit(1);
-                }
-            }
-            s[i++] = (char32_t)c;
-            if (i >= capacity) {
-                capacity *= 2;
-                s = s_realloc(s, capacity * sizeof(char32_t));
-            }
-        }
-        return (Val){TYPE_CONST_STRING, {.string_data = new_string(i, s)}};
+    if (first == '"') {
+        in->ptr++;
+        *val = (Val){TYPE_CONST_STRING, {.string_data = read_string(in)}};
+        return 0;
     }
 
-    // name
-    size_t i = 1;
-    s[0] = (char32_t)c;
-    while ((c = parser_fgetc32(f)) != EOF32 && !(is_whitespace((char32_t)c) || is_control((char32_t)c))
-            && c != ';' && c != '(' && c != ')' && c != '\'' && c != '"') {
-        s[i++] = (char32_t)c;
-        if (i >= capacity) {
-            capacity *= 2;
-            s = s_realloc(s, capacity * sizeof(char32_t));
+    // name, whose characters are only decoded if it isn't all ASCII
+    in->mark = in->ptr;
+    int ascii = 1;
+    while (1) {
+        in->ptr = scan_ascii_name(in->ptr, in->end);
+        if (in->ptr == in->end) {
+            if (!input_fill(in))
+                break;
+            continue;
+        }
+        if (*in->ptr < 0x80)
+            break;
+        size_t offset = (size_t)(in->ptr - in->mark);
+        int32_t c = input_getc32(in);
+        if (is_whitespace((char32_t)c) || is_control((char32_t)c)) {
+            in->ptr = in->mark + offset;
+            break;
         }
+        ascii = 0;
     }
-    parser_buffer = (char32_t)c;
+    const unsigned char *token = in->mark;
+    size_t size = (size_t)(in->ptr - token);
+    in->mark = NULL;
 
     // numeric literal
-    if (('0' <= s[0] && s[0] <= '9') || ((s[0] == '+' || s[0] == '-') && i > 1)) {
-        char *num = s_malloc(i + 1);
-        for (size_t j = 0; j < i; j++) {
-            if (('0' <= s[j] && s[j] <= '9') || s[j] == '+' || s[j] == '-' || s[j] == '.')
-                num[j] = (char)s[j];
-            else
-                goto invalid_num;
-        }
-        num[i] = '\0';
-        char *endptr;
-        long long int_val = strtoll(num, &endptr, 10);
-        if (*endptr == '\0') {
-            free(s);
-            free(num);
-            return (Val){TYPE_INT, {.int_data = int_val}};
-        }
-        double float_val = strtod(num, &endptr);
-        if (*endptr == '\0') {
-            free(s);
-            free(num);
-            return (Val){TYPE_FLOAT, {.float_data = float_val}};
-        }
-invalid_num:
-        free(num);
-        eprintf("Syntax error: incorrect numeric literal ");
-        eputs32(new_gc_string(i, s));
-        eprintf("\n");
-        exit(1);
+    if (('0' <= first && first <= '9') || ((first == '+' || first == '-') && size > 1)) {
+        *val = read_number(token, size);
+        return 0;
     }
 
-    if (i == 1 && (s[0] == '.' || s[0] == '#')) {
-        Pair *pair = gc_alloc(sizeof(Pair));
-        pair->car = (Val){TYPE_SYMBOL, {.string_data = new_interned_string_from_cstring("token")}};
-        pair->cdr = (Val){TYPE_INT, {.int_data = s[0]}};
-        free(s);
-        return (Val){TYPE_PAIR, {.pair_data = pair}};
-    }
+    if (size == 1 && (first == '.' || first == '#'))
+        return first;
 
     // bool, char, or special
-    if (s[0] == '#') {
+    if (first == '#') {
         // char
-        if (s[1] == '\\') {
-            if (i == 2) {
-                char32_t c = parser_buffer;
-                parser_buffer = UINT32_MAX;
-                free(s);
-                return (Val){TYPE_CHAR, {.char_data = c}};
-            } if (i == 3) {
-                char32_t c = s[2];
-                free(s);
-                return (Val){TYPE_CHAR, {.char_data = c}};
-            } if (strbuf_eq_cstr(i, s, "#\\space")) {
-                free(s);
-                return (Val){TYPE_CHAR, {.char_data = ' '}};
-            } if (strbuf_eq_cstr(i, s, "#\\newline")) {
-                free(s);
-                return (Val){TYPE_CHAR, {.char_data = '\n'}};
+        if (token[1] == '\\') {
+            if (size == 2) {
+                int32_t c = input_getc32(in);
+                if (c == EOF32)
+                    unexpected_eof();
+                *val = (Val){TYPE_CHAR, {.char_data = (char32_t)c}};
+                return 0;
+            }
+            if (ascii ? size == 3 : decode_name(token, size) == 3) {
+                *val = (Val){TYPE_CHAR, {.char_data = ascii ? token[2] : scratch[2]}};
+                return 0;
             }
-        } if (strbuf_eq_cstr(i, s, "#f")) {
-            free(s);
-            return (Val){TYPE_BOOL, {.int_data = 0}};
-        } if (strbuf_eq_cstr(i, s, "#t")) {
-            free(s);
-            return (Val){TYPE_BOOL, {.int_data = 1}};
-        } if (strbuf_eq_cstr(i, s, "#!void")) {
-            free(s);
-            return (Val){TYPE_VOID};
-        } if (strbuf_eq_cstr(i, s, "#!undef")) {
-            free(s);
-            return (Val){TYPE_UNDEF};
-        }
-        eprintf("Syntax error: incorrect literal ");
-        eputs32(new_gc_string(i, s));
-        eprintf("\n");
+            if (token_eq(token, size, "#\\space")) {
+                *val = (Val){TYPE_CHAR, {.char_data = ' '}};
+                return 0;
+            }
+            if (token_eq(token, size, "#\\newline")) {
+                *val = (Val){TYPE_CHAR, {.char_data = '\n'}};
+                return 0;
+            }
+        }
+        if (token_eq(token, size, "#f")) {
+            *val = (Val){TYPE_BOOL, {.int_data = 0}};
+            return 0;
+        }
+        if (token_eq(token, size, "#t")) {
+            *val = (Val){TYPE_BOOL, {.int_data = 1}};
+            return 0;
+        }
+        if (token_eq(token, size, "#!void")) {
+            *val = (Val){TYPE_VOID};
+            return 0;
+        }
+        if (token_eq(token, size, "#!undef")) {
+            *val = (Val){TYPE_UNDEF};
+            return 0;
+        }
+        eprintf("Syntax error: incorrect literal %.*s\n", (int)size, (const char *)token);
         exit(1);
     }
 
-    String *str = new_interned_string(i, s);
-    free(s);
-    return (Val){TYPE_SYMBOL, {.string_data = str}};
+    String *str;
+    if (ascii) {
+        str = new_interned_string_from_ascii(size, (const char *)token);
+    } else {
+        size_t len = decode_name(token, size);
+        str = new_interned_string(len, scratch);
+    }
+    *val = (Val){TYPE_SYMBOL, {.string_data = str}};
+    return 0;
+}
+
+/* -- Reader_frame
+ * An unfinished datum of the reader: a list, which is made into a vector if
+ * `vector` is set, a list after its '.', whose tail has been read if it's
+ * `FRAME_LIST_END`, or a datum following '\'' or '#'. The elements of a list
+ * read so far are kept in reverse order at `stack_pos` on the stack, followed
+ * by its tail, so that the garbage collector finds them.
+ */
+typedef struct Reader_frame {
+    enum { FRAME_LIST, FRAME_TAIL, FRAME_LIST_END, FRAME_QUOTE, FRAME_HASH } kind;
+    int vector;
+    Val *stack_pos;
+} Reader_frame;
+
+static Reader_frame *reader_frames = NULL;
+static size_t reader_frames_size = 0;
+
+static void syntax_error(const char *msg) {
+    eprintf("Syntax error: %s\n", msg);
+    exit(1);
+}
+
+static Val cons(Val car, Val cdr) {
+    stack_push(car);
+    stack_push(cdr);
+    Pair *pair = gc_alloc(TYPE_PAIR, sizeof(Pair));
+    pair->cdr = stack_pop();
+    pair->car = stack_pop();
+    return (Val){TYPE_PAIR, {.pair_data = pair}};
+}
+
+/* -- list_to_vector
+ * Returns a vector of the elements of `list`, or raises a syntax error
+ * if it isn't a proper list.
+ */
+static Val list_to_vector(Val list) {
+    size_t len = 0;
+    for (Val val = list; val.type != TYPE_NIL; val = val.pair_data->cdr) {
+        if (val.type != TYPE_PAIR)
+            syntax_error("expected list or name after #");
+        len++;
+    }
+    stack_push(list);
+    Vector *vec = gc_alloc(TYPE_VECTOR, sizeof(Vector) + (len ? len : 1) * sizeof(Val));
+    list = stack_pop();
+    vec->len = len;
+    vec->vals[0].type = TYPE_INT;
+    for (size_t i = 0; i < len; i++, list = list.pair_data->cdr)
+        vec->vals[i] = list.pair_data->car;
+    return (Val){TYPE_VECTOR, {.vector_data = vec}};
+}
+
+/* -- read_datum
+ * Reads a datum from `f`, in which a datum 'x is read as the list (quote x).
+ * Nested data are kept on an explicit stack of frames rather than the C stack,
+ * so that the depth of nesting is only limited by the stack of the machine.
+ */
+Val read_datum(FILE *f, Val quote) {
+    Input *in = get_input(f);
+    Val *base = stack_ptr;
+    stack_push(quote);
+    size_t frames_num = 0;
+    Val val;
+    while (1) {
+        int token = read_token(in, &val);
+        Reader_frame *top = frames_num > 0 ? &reader_frames[frames_num - 1] : NULL;
+        if (top != NULL && top->kind == FRAME_LIST_END && token != ')')
+            syntax_error("expected ')'");
+        if (token == '(' || token == '\'' || token == '#') {
+            if (token == '(' && top != NULL && top->kind == FRAME_HASH) {
+                top->kind = FRAME_LIST;
+                top->vector = 1;
+            } else {
+                if (frames_num == reader_frames_size) {
+                    reader_frames_size = reader_frames_size ? 2 * reader_frames_size : 16;
+                    reader_frames = s_realloc(reader_frames, reader_frames_size * sizeof(Reader_frame));
+                }
+                top = &reader_frames[frames_num++];
+                top->kind = token == '(' ? FRAME_LIST : token == '#' ? FRAME_HASH : FRAME_QUOTE;
+                top->vector = 0;
+            }
+            if (top->kind == FRAME_LIST) {
+                top->stack_pos = stack_ptr;
+                stack_push((Val){TYPE_NIL});
+            }
+            continue;
+        }
+        if (token == '.') {
+            if (top == NULL || top->kind != FRAME_LIST)
+                syntax_error("unexpected '.'");
+            top->kind = FRAME_TAIL;
+            continue;
+        }
+        if (token == ')') {
+            if (top == NULL || (top->kind != FRAME_LIST && top->kind != FRAME_LIST_END))
+                syntax_error("unexpected ')'");
+            // the list is reversed in place, which doesn't allocate
+            val = top->kind == FRAME_LIST_END ? stack_pop() : (Val){TYPE_NIL};
+            for (Val list = top->stack_pos[0]; list.type != TYPE_NIL; ) {
+                Val next = list.pair_data->cdr;
+                list.pair_data->cdr = val;
+                gc_write_barrier(&list.pair_data->cdr);
+                val = list;
+                list = next;
+            }
+            stack_ptr = top->stack_pos;
+            if (top->vector)
+                val = list_to_vector(val);
+            frames_num--;
+        }
+
+        // `val` is a complete datum, which completes the frames waiting for it
+        while (1) {
+            if (frames_num == 0) {
+                stack_ptr = base;
+                return val;
+            }
+            top = &reader_frames[frames_num - 1];
+            if (top->kind == FRAME_QUOTE) {
+                val = cons(*base, cons(val, (Val){TYPE_NIL}));
+                frames_num--;
+            } else if (top->kind == FRAME_HASH) {
+                val = list_to_vector(val);
+                frames_num--;
+            } else if (top->kind == FRAME_TAIL) {
+                stack_push(val);
+                top->kind = FRAME_LIST_END;
+                break;
+            } else {
+                top->stack_pos[0] = cons(val, top->stack_pos[0]);
+                break;
+            }
+        }
+    }
 }
 
 uint32_t read_expr(FILE *f) {
@@ -246,6 +656,9 @@ uint32_t read_expr(FILE *f) {
     compiler_input_file = f;
     uint32_t program = next_inst();
     insts[program] = (Inst){INST_EXPR};
+    if (f == source_file)
+        add_source_pos(program, source_name, input_line(get_input(f)));
     exec(compile_pc, compiler_env);
+    specialize_insts(program, this_inst());
     return program;
 }
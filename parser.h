@@ -1,6 +1,6 @@
 #include "types.h"
 
-int32_t fgetc32_nospace(FILE *f);
+void parser_set_source(FILE *f, const char *name);
 int parser_init(FILE *f);
-Val get_token(FILE *f);
+Val read_datum(FILE *f, Val quote);
 uint32_t read_expr(FILE *f);
@@ -1,7 +1,11 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "primitives.h"
 #include "types.h"
 #include "primitives/char.h"
 #include "primitives/compiler.h"
+#include "primitives/gc.h"
 #include "primitives/io.h"
 #include "primitives/list.h"
 #include "primitives/number.h"
@@ -148,13 +152,14 @@ static struct CString_binding cstring_r5rs_bindings[] = {
     PRIM("display", display_prim),
     PRIM("newline", newline_prim),
     PRIM("error", error_prim),
-    H_PRIM("read", read_prim),
+    PRIM("read", read_prim),
+    PRIM("gc-stats", gc_stats_prim),
 };
 
 uint32_t r5rs_bindings_size = sizeof(cstring_r5rs_bindings) / sizeof(struct CString_binding);
 
 static struct CString_binding cstring_compiler_bindings[] = {
-    PRIM("next-token", next_token_prim),
+    PRIM("read-datum", read_datum_prim),
     PRIM("this-inst", this_inst_prim),
     PRIM("next-inst", next_inst_prim),
     PRIM("set-const!", set_const_prim),
@@ -171,12 +176,28 @@ static struct CString_binding cstring_compiler_bindings[] = {
     PRIM("set-return!", set_return_prim),
     PRIM("set-delete!", set_delete_prim),
     PRIM("set-cons!", set_cons_prim),
+    PRIM("set-add!", set_add_prim),
+    PRIM("set-sub!", set_sub_prim),
+    PRIM("set-lt!", set_lt_prim),
+    PRIM("set-num-eq!", set_num_eq_prim),
     PRIM("const-cons", const_cons_prim),
     PRIM("const-vector", const_vector_prim),
 };
 
 uint32_t compiler_bindings_size = sizeof(cstring_compiler_bindings) / sizeof(struct CString_binding);
 
+/* -- r5rs_binding
+ * Returns the index of the binding of a standard procedure, which is
+ * the same in every global environment, since they all start with `r5rs_bindings`.
+ */
+static uint32_t r5rs_binding(const char *name) {
+    for (uint32_t i = 0; i < r5rs_bindings_size; i++)
+        if (strcmp(cstring_r5rs_bindings[i].var, name) == 0)
+            return i;
+    eprintf("Internal error: no standard procedure %s\n", name);
+    exit(1);
+}
+
 void setup_primitives(void) {
     r5rs_bindings = s_malloc(r5rs_bindings_size * sizeof(Binding));
     for (uint32_t i = 0; i < r5rs_bindings_size; i++)
@@ -186,4 +207,8 @@ void setup_primitives(void) {
     for (uint32_t i = 0; i < compiler_bindings_size; i++)
         compiler_bindings[i] = (Binding){cstring_compiler_bindings[i].val,
             new_interned_string_from_cstring(cstring_compiler_bindings[i].var)};
+    add_binding = r5rs_binding("+");
+    sub_binding = r5rs_binding("-");
+    lt_binding = r5rs_binding("<");
+    num_eq_binding = r5rs_binding("=");
 }
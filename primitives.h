@@ -5,3 +5,7 @@ Binding *r5rs_bindings;
 uint32_t r5rs_bindings_size;
 Binding *compiler_bindings;
 uint32_t compiler_bindings_size;
+uint32_t add_binding;
+uint32_t sub_binding;
+uint32_t lt_binding;
+uint32_t num_eq_binding;
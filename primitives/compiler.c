@@ -21,9 +21,9 @@ static uint32_t u32_int_data(Val val) {
 
 FILE *compiler_input_file;
 
-Val next_token_prim(Val *args, uint32_t num) {
-    args_assert(num == 0);
-    return get_token(compiler_input_file);
+Val read_datum_prim(Val *args, uint32_t num) {
+    args_assert(num == 1);
+    return read_datum(compiler_input_file, args[0]);
 }
 
 Val this_inst_prim(Val *args, uint32_t num) {
@@ -38,7 +38,7 @@ Val set_const_prim(Val *args, uint32_t num) {
     args_assert(num == 2);
     if (args[0].type != TYPE_INT)
         type_error(args[0]);
-    insts[u32_int_data(args[0])] = (Inst){INST_CONST, {.val = args[1]}};
+    insts[u32_int_data(args[0])] = (Inst){INST_CONST, {.index = new_const(args[1])}};
     return (Val){TYPE_VOID};
 }
 
@@ -60,7 +60,7 @@ Val set_name_prim(Val *args, uint32_t num) {
         type_error(args[0]);
     if (args[1].type != TYPE_SYMBOL)
         type_error(args[1]);
-    insts[u32_int_data(args[0])] = (Inst){INST_NAME, {.name = args[1].string_data}};
+    insts[u32_int_data(args[0])] = (Inst){INST_NAME, {.index = new_const(args[1])}};
     return (Val){TYPE_VOID};
 }
 
@@ -70,7 +70,7 @@ Val set_def_prim(Val *args, uint32_t num) {
         type_error(args[0]);
     if (args[1].type != TYPE_SYMBOL)
         type_error(args[1]);
-    insts[u32_int_data(args[0])] = (Inst){INST_DEF, {.name = args[1].string_data}};
+    insts[u32_int_data(args[0])] = (Inst){INST_DEF, {.index = new_const(args[1])}};
     return (Val){TYPE_VOID};
 }
 
@@ -92,7 +92,7 @@ Val set_set_name_prim(Val *args, uint32_t num) {
         type_error(args[0]);
     if (args[1].type != TYPE_SYMBOL)
         type_error(args[1]);
-    insts[u32_int_data(args[0])] = (Inst){INST_SET_NAME, {.name = args[1].string_data}};
+    insts[u32_int_data(args[0])] = (Inst){INST_SET_NAME, {.index = new_const(args[1])}};
     return (Val){TYPE_VOID};
 }
 
@@ -117,7 +117,7 @@ Val set_jump_false_prim(Val *args, uint32_t num) {
 }
 
 Val set_lambda_prim(Val *args, uint32_t num) {
-    args_assert(num == 4);
+    args_assert(num == 5);
     if (args[0].type != TYPE_INT)
         type_error(args[0]);
     if (args[1].type != TYPE_BOOL)
@@ -126,9 +126,13 @@ Val set_lambda_prim(Val *args, uint32_t num) {
         type_error(args[2]);
     if (args[3].type != TYPE_INT)
         type_error(args[3]);
+    if (args[4].type != TYPE_BOOL)
+        type_error(args[4]);
     uint32_t params = u32_int_data(args[2]);
     if (u32_int_data(args[1]))
         params |= PARAMS_VARIADIC;
+    if (u32_int_data(args[4]))
+        params |= PARAMS_STACK_FRAME;
     insts[u32_int_data(args[0])] = (Inst){INST_LAMBDA, {.lambda = {params, u32_int_data(args[3])}}};
     return (Val){TYPE_VOID};
 }
@@ -177,6 +181,30 @@ Val set_cons_prim(Val *args, uint32_t num) {
     return (Val){TYPE_VOID};
 }
 
+static Val set_inline_prim(Val *args, uint32_t num, enum Inst_type type) {
+    args_assert(num == 1);
+    if (args[0].type != TYPE_INT)
+        type_error(args[0]);
+    insts[u32_int_data(args[0])] = (Inst){type, {.num = 2}};
+    return (Val){TYPE_VOID};
+}
+
+Val set_add_prim(Val *args, uint32_t num) {
+    return set_inline_prim(args, num, INST_ADD);
+}
+
+Val set_sub_prim(Val *args, uint32_t num) {
+    return set_inline_prim(args, num, INST_SUB);
+}
+
+Val set_lt_prim(Val *args, uint32_t num) {
+    return set_inline_prim(args, num, INST_LT);
+}
+
+Val set_num_eq_prim(Val *args, uint32_t num) {
+    return set_inline_prim(args, num, INST_NUM_EQ);
+}
+
 Val const_cons_prim(Val *args, uint32_t num) {
     args_assert(num == 2);
     Pair *pair = s_malloc(sizeof(Pair));
@@ -3,7 +3,7 @@
 
 FILE *compiler_input_file;
 
-Val next_token_prim(Val *args, uint32_t num);
+Val read_datum_prim(Val *args, uint32_t num);
 Val this_inst_prim(Val *args, uint32_t num);
 Val next_inst_prim(Val *args, uint32_t num);
 Val set_const_prim(Val *args, uint32_t num);
@@ -20,5 +20,9 @@ Val set_tail_call_prim(Val *args, uint32_t num);
 Val set_return_prim(Val *args, uint32_t num);
 Val set_delete_prim(Val *args, uint32_t num);
 Val set_cons_prim(Val *args, uint32_t num);
+Val set_add_prim(Val *args, uint32_t num);
+Val set_sub_prim(Val *args, uint32_t num);
+Val set_lt_prim(Val *args, uint32_t num);
+Val set_num_eq_prim(Val *args, uint32_t num);
 Val const_cons_prim(Val *args, uint32_t num);
 Val const_vector_prim(Val *args, uint32_t num);
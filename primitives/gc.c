@@ -0,0 +1,58 @@
+#include "gc.h"
+#include "../types.h"
+#include "../exec_stack.h"
+#include "../memory.h"
+#include "../string.h"
+#include "assert.h"
+
+/* -- push_entry
+ * Replaces the list on top of the stack with the list extended in front
+ * by a pair of the symbol `name` and `val`.
+ */
+static void push_entry(char *name, Val val) {
+    stack_push(val);
+    Pair *entry = gc_alloc(TYPE_PAIR, sizeof(Pair));
+    entry->car = (Val){TYPE_SYMBOL, {.string_data = new_interned_string_from_cstring(name)}};
+    entry->cdr = stack_pop();
+    stack_push((Val){TYPE_PAIR, {.pair_data = entry}});
+    Pair *pair = gc_alloc(TYPE_PAIR, sizeof(Pair));
+    pair->car = stack_pop();
+    pair->cdr = stack_pop();
+    stack_push((Val){TYPE_PAIR, {.pair_data = pair}});
+}
+
+static Val int_val(uint64_t n) {
+    return (Val){TYPE_INT, {.int_data = (long long)n}};
+}
+
+/* -- gc_stats_prim
+ * Returns the garbage collector statistics as an association list.
+ * The value of `pause-histogram` is a list of the numbers of collections
+ * in each bucket, as described in memory.h.
+ */
+Val gc_stats_prim(Val *args, uint32_t num) {
+    args_assert(num == 0);
+    // the statistics are taken first, as building the list may change them
+    GC_stats stats = get_gc_stats();
+    stack_push((Val){TYPE_NIL});
+    for (size_t i = GC_PAUSE_BUCKETS; i-- > 0; ) {
+        Pair *pair = gc_alloc(TYPE_PAIR, sizeof(Pair));
+        pair->car = int_val(stats.pause_histogram[i]);
+        pair->cdr = stack_pop();
+        stack_push((Val){TYPE_PAIR, {.pair_data = pair}});
+    }
+    Val histogram = stack_pop();
+    stack_push((Val){TYPE_NIL});
+    push_entry("pause-histogram", histogram);
+    push_entry("max-pause-ns", int_val(stats.max_pause_ns));
+    push_entry("total-pause-ns", int_val(stats.total_pause_ns));
+    push_entry("heap-shrinks", int_val(stats.heap_shrinks));
+    push_entry("heap-growths", int_val(stats.heap_growths));
+    push_entry("peak-heap-size", int_val(stats.peak_heap_size));
+    push_entry("heap-size", int_val(stats.heap_size));
+    push_entry("bytes-copied", int_val(stats.bytes_copied));
+    push_entry("bytes-allocated", int_val(stats.bytes_allocated));
+    push_entry("major-collections", int_val(stats.major_collections));
+    push_entry("minor-collections", int_val(stats.minor_collections));
+    return stack_pop();
+}
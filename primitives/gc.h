@@ -0,0 +1,3 @@
+#include "../types.h"
+
+Val gc_stats_prim(Val *args, uint32_t num);
@@ -4,13 +4,10 @@
 #include "io.h"
 #include "../types.h"
 #include "../display.h"
-#include "../env.h"
-#include "../exec_stack.h"
-#include "../insts.h"
 #include "../parser.h"
 #include "../safestd.h"
+#include "../string.h"
 #include "assert.h"
-#include "compiler.h"
 
 Val display_prim(Val *args, uint32_t num) {
     args_assert(num == 1);
@@ -39,11 +36,9 @@ Val error_prim(Val *args, uint32_t num) {
     exit(1);
 }
 
-High_prim_return read_prim(Val *args, uint32_t num) {
+Val read_prim(Val *args, uint32_t num) {
     args_assert(num == 0);
-    stack_pop();
     if (!parser_init(stdin))
         exit(0);
-    compiler_input_file = stdin;
-    return (High_prim_return){parse_pc, compiler_env};
+    return read_datum(stdin, (Val){TYPE_SYMBOL, {.string_data = new_interned_string_from_cstring("quote")}});
 }
@@ -3,4 +3,4 @@
 Val display_prim(Val *args, uint32_t num);
 Val newline_prim(Val *args, uint32_t num);
 Val error_prim(Val *args, uint32_t num);
-High_prim_return read_prim(Val *args, uint32_t num);
+Val read_prim(Val *args, uint32_t num);
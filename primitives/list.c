@@ -34,7 +34,7 @@ Val list_q_prim(Val *args, uint32_t num) {
 Val list_prim(Val *args, uint32_t num) {
     stack_push((Val){TYPE_NIL});
     for (Val *arg_ptr = args + num - 1; arg_ptr >= args; arg_ptr--) {
-        Pair *pair = gc_alloc(sizeof(Pair));
+        Pair *pair = gc_alloc(TYPE_PAIR, sizeof(Pair));
         pair->car = *arg_ptr;
         pair->cdr = stack_pop();
         stack_push((Val){TYPE_PAIR, {.pair_data = pair}});
@@ -69,7 +69,7 @@ Val append_prim(Val *args, uint32_t num) {
             type_error(arg);
         stack_push(val);
         for (uint32_t j = 0; j < length; j++) {
-            Pair *pair = gc_alloc(sizeof(Pair));
+            Pair *pair = gc_alloc(TYPE_PAIR, sizeof(Pair));
             pair->cdr = stack_pop();
             pair->car = stack_pop();
             stack_push((Val){TYPE_PAIR, {.pair_data = pair}});
@@ -85,7 +85,7 @@ Val reverse_prim(Val *args, uint32_t num) {
     stack_push((Val){TYPE_NIL});
     stack_push(tail);
     while (tail.type == TYPE_PAIR || tail.type == TYPE_CONST_PAIR) {
-        Pair *pair = gc_alloc(sizeof(Pair));
+        Pair *pair = gc_alloc(TYPE_PAIR, sizeof(Pair));
         tail = stack_pop();
         pair->car = tail.pair_data->car;
         pair->cdr = stack_pop();
@@ -212,7 +212,7 @@ High_prim_return map_prim_continuation(Val *args, uint32_t num) {
             stack_ptr = args + n + k + 2;
             stack_push((Val){TYPE_NIL});
             for (uint32_t j = k; j > 0; j--) {
-                Pair *pair = gc_alloc(sizeof(Pair));
+                Pair *pair = gc_alloc(TYPE_PAIR, sizeof(Pair));
                 pair->cdr = stack_pop();
                 pair->car = stack_pop();
                 stack_push((Val){TYPE_PAIR, {.pair_data = pair}});
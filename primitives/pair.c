@@ -8,7 +8,7 @@
 
 Val cons_prim(Val *args, uint32_t num) {
     args_assert(num == 2);
-    Pair *pair = gc_alloc(sizeof(Pair));
+    Pair *pair = gc_alloc(TYPE_PAIR, sizeof(Pair));
     pair->car = args[0];
     pair->cdr = args[1];
     return (Val){TYPE_PAIR, {.pair_data = pair}};
@@ -189,6 +189,7 @@ Val set_car_prim(Val *args, uint32_t num) {
     if (args[0].type != TYPE_PAIR)
         type_error(args[0]);
     args[0].pair_data->car = args[1];
+    gc_write_barrier(&args[0].pair_data->car);
     return (Val){TYPE_VOID};
 }
 
@@ -201,5 +202,6 @@ Val set_cdr_prim(Val *args, uint32_t num) {
     if (args[0].type != TYPE_PAIR)
         type_error(args[0]);
     args[0].pair_data->cdr = args[1];
+    gc_write_barrier(&args[0].pair_data->cdr);
     return (Val){TYPE_VOID};
 }
@@ -40,8 +40,10 @@ int eq(Val val1, Val val2) {
     case TYPE_BROKEN_HEART:
     case TYPE_ENV:
     case TYPE_INST:
+    case TYPE_FRAME_INST:
     case TYPE_GLOBAL_ENV:
     case TYPE_PRINT_CONTROL:
+    case TYPE_HEADER:
         return 0;
     }
     return 0;
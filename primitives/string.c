@@ -199,7 +199,7 @@ Val string_to_list_prim(Val *args, uint32_t num) {
     stack_push(args[0]);
     stack_push((Val){TYPE_NIL});
     for (size_t i = arg->string_data->len; i-- > 0; ) {
-        Pair *pair = gc_alloc(sizeof(Pair));
+        Pair *pair = gc_alloc(TYPE_PAIR, sizeof(Pair));
         pair->car = (Val){TYPE_CHAR, {.char_data = arg->string_data->chars[i]}};
         pair->cdr = stack_pop();
         stack_push((Val){TYPE_PAIR, {.pair_data = pair}});
@@ -9,7 +9,7 @@
 #include "assert.h"
 
 static Vector *gc_alloc_vector(size_t len) {
-    Vector *vec = gc_alloc(sizeof(Vector) + (len ? len : 1) * sizeof(Val));
+    Vector *vec = gc_alloc(TYPE_VECTOR, sizeof(Vector) + (len ? len : 1) * sizeof(Val));
     vec->len = len;
     vec->vals[0].type = TYPE_INT;
     return vec;
@@ -17,9 +17,6 @@ static Vector *gc_alloc_vector(size_t len) {
 
 Val make_vector_prim(Val *args, uint32_t num) {
     args_assert(num == 1 || num == 2);
-    Val e = (Val){TYPE_VOID};
-    if (num == 2)
-        e = args[1];
     if (args[0].type != TYPE_INT)
         type_error(args[0]);
     if (args[0].int_data < 0) {
@@ -27,6 +24,10 @@ Val make_vector_prim(Val *args, uint32_t num) {
         exit(1);
     }
     Vector *vec = gc_alloc_vector((size_t)args[0].int_data);
+    // the fill value is read after allocating, since it may have been moved
+    Val e = (Val){TYPE_VOID};
+    if (num == 2)
+        e = args[1];
     for (size_t i = 0; i < args[0].int_data; i++)
         vec->vals[i] = e;
     return (Val){TYPE_VECTOR, {.vector_data = vec}};
@@ -73,6 +74,7 @@ Val vector_set_prim(Val *args, uint32_t num) {
         exit(1);
     }
     args[0].vector_data->vals[args[1].int_data] = args[2];
+    gc_write_barrier(&args[0].vector_data->vals[args[1].int_data]);
     return (Val){TYPE_VOID};
 }
 
@@ -84,7 +86,7 @@ Val vector_to_list_prim(Val *args, uint32_t num) {
     stack_push(args[0]);
     stack_push((Val){TYPE_NIL});
     for (size_t i = arg->vector_data->len; i-- > 0; ) {
-        Pair *pair = gc_alloc(sizeof(Pair));
+        Pair *pair = gc_alloc(TYPE_PAIR, sizeof(Pair));
         pair->car = arg->vector_data->vals[i];
         pair->cdr = stack_pop();
         stack_push((Val){TYPE_PAIR, {.pair_data = pair}});
@@ -117,7 +119,9 @@ Val vector_fill_prim(Val *args, uint32_t num) {
     }
     if (args[0].type != TYPE_VECTOR)
         type_error(args[0]);
-    for (size_t i = 0; i < args[0].vector_data->len; i++)
+    for (size_t i = 0; i < args[0].vector_data->len; i++) {
         args[0].vector_data->vals[i] = args[1];
+        gc_write_barrier(&args[0].vector_data->vals[i]);
+    }
     return (Val){TYPE_VOID};
 }
@@ -0,0 +1,145 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "profile.h"
+#include "types.h"
+#include "insts.h"
+#include "jit.h"
+#include "safestd.h"
+
+/* == profile.c
+ * The sampling profiler uses a timer which measures the CPU time used by
+ * the interpreter and signals it every PROFILE_INTERVAL microseconds.
+ * The signal handler only sets `profile_pending`, and the sample is taken
+ * by exec() at the next call, so that the state of the machine is consistent.
+ *
+ * A sample consists of the instructions being executed in each active
+ * function - the call instructions preceding the return addresses saved
+ * on the stack, followed by the current instruction. At exit, each of them
+ * is replaced by the lambda containing it, and the resulting call stacks are
+ * written to a file in the collapsed stack format used by flame graph tools,
+ * with one line for each distinct call stack followed by its number of samples.
+ */
+
+#ifndef PROFILE_INTERVAL
+#define PROFILE_INTERVAL 1000
+#endif
+
+static const char *profile_file_name;
+
+/* -- samples
+ * Contains the samples one after another, each stored as its number
+ * of instructions followed by the instructions, starting from the bottom
+ * of the stack.
+ */
+static uint32_t *samples = NULL;
+static size_t samples_size = 0;
+static size_t samples_index = 0;
+
+static void push_sample(uint32_t n) {
+    if (samples_index >= samples_size) {
+        samples_size = samples_size ? samples_size * 2 : 4096;
+        samples = s_realloc(samples, samples_size * sizeof(uint32_t));
+    }
+    samples[samples_index++] = n;
+}
+
+static void handle_profile_signal(int sig) {
+    profile_pending = 1;
+}
+
+void take_profile_sample(uint32_t pc, Val *stack_start, Val *stack_end) {
+    profile_pending = 0;
+    size_t depth_index = samples_index;
+    uint32_t depth = 1;
+    push_sample(0);
+    for (Val *val_ptr = stack_start; val_ptr < stack_end; val_ptr++) {
+        // a lambda tail called from the top level returns to return_inst, which has no caller
+        if ((val_ptr->type == TYPE_INST || val_ptr->type == TYPE_FRAME_INST) && val_ptr->inst_data != return_inst) {
+            push_sample(jit_source_pc(val_ptr->inst_data - 1));
+            depth++;
+        }
+    }
+    push_sample(jit_source_pc(pc));
+    samples[depth_index] = depth;
+}
+
+/* -- has_frame
+ * Checks whether an instruction is part of a lambda or of a source file.
+ * Other instructions, such as the continuations of primitives which call
+ * procedures, are left out of the call stacks.
+ */
+static int has_frame(uint32_t *lambdas, uint32_t pc) {
+    return lambdas[pc] != UINT32_MAX || find_source_pos(pc) != NULL;
+}
+
+/* -- print_frame
+ * Prints the name of the function containing an instruction as a frame
+ * of a call stack.
+ */
+static void print_frame(FILE *f, uint32_t *lambdas, uint32_t pc) {
+    if (lambdas[pc] != UINT32_MAX) {
+        print_lambda(f, lambdas[pc]);
+        return;
+    }
+    const Source_pos *pos = find_source_pos(pc);
+    fprintf(f, "top level (%s:%"PRIu32")", pos->file, pos->line);
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void write_profile(void) {
+    setitimer(ITIMER_PROF, &(struct itimerval){{0, 0}, {0, 0}}, NULL);
+    uint32_t *lambdas = find_lambdas();
+    size_t stacks_num = 0;
+    char **stacks = s_malloc((samples_index + 1) * sizeof(char *));
+    for (size_t i = 0; i < samples_index; i += samples[i] + 1) {
+        size_t len;
+        FILE *f = open_memstream(&stacks[stacks_num], &len);
+        int empty = 1;
+        for (uint32_t j = 1; j <= samples[i]; j++) {
+            if (!has_frame(lambdas, samples[i + j]))
+                continue;
+            if (!empty)
+                putc(';', f);
+            print_frame(f, lambdas, samples[i + j]);
+            empty = 0;
+        }
+        fclose(f);
+        stacks_num++;
+    }
+    qsort(stacks, stacks_num, sizeof(char *), compare_strings);
+    FILE *profile_file = s_fopen(profile_file_name, "w");
+    for (size_t i = 0; i < stacks_num; ) {
+        size_t j = i + 1;
+        while (j < stacks_num && strcmp(stacks[i], stacks[j]) == 0)
+            j++;
+        if (stacks[i][0] != '\0')
+            fprintf(profile_file, "%s %zu\n", stacks[i], j - i);
+        i = j;
+    }
+    fclose(profile_file);
+    for (size_t i = 0; i < stacks_num; i++)
+        free(stacks[i]);
+    free(stacks);
+    free(lambdas);
+}
+
+/* -- start_profile
+ * Starts the profiling timer. The profile is written to the given file at exit.
+ */
+void start_profile(const char *file_name) {
+    profile_file_name = file_name;
+    struct sigaction action = {0};
+    action.sa_handler = handle_profile_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    setitimer(ITIMER_PROF, &(struct itimerval){{0, PROFILE_INTERVAL}, {0, PROFILE_INTERVAL}}, NULL);
+    atexit(write_profile);
+}
@@ -0,0 +1,12 @@
+#include <signal.h>
+
+#include "types.h"
+
+/* == profile.h
+ * `profile_pending` is set by the profiling timer when a sample should be
+ * taken. exec() checks it on every call and then takes the sample.
+ */
+
+volatile sig_atomic_t profile_pending;
+void start_profile(const char *file_name);
+void take_profile_sample(uint32_t pc, Val *stack_start, Val *stack_end);
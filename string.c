@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -7,17 +8,112 @@
 #include "memory.h"
 #include "safestd.h"
 
+/* == obarray
+ * The obarray is a hash table of interned strings, using open addressing
+ * with linear probing. Each entry stores the hash of its string, so that
+ * most mismatches can be rejected without comparing characters.
+ *
+ * When the table becomes half full, a new table twice as large is allocated.
+ * Rather than rehashing the whole table at once, every following insertion
+ * moves OBARRAY_MIGRATION_STEP entries of the old table into the new one.
+ * Until all of them are moved, lookups search both tables. Entries are never
+ * removed from the old table, so its probe sequences remain intact.
+ * New strings are always inserted into the new table.
+ */
+
+#define OBARRAY_MIGRATION_STEP 4
+
+typedef struct Obarray_entry {
+    String *str;
+    uint32_t hash;
+} Obarray_entry;
+
 static size_t obarray_size = 256;
-static String **obarray;
-static String **obarray_end;
+static size_t obarray_count = 0;
+static Obarray_entry *obarray;
+
+static size_t old_obarray_size;
+static Obarray_entry *old_obarray = NULL;
+static size_t old_obarray_moved;
 
 /* -- setup_obarray
  * Sets up the variables providing the obarray.
  * Should be called at the beginning of `main`.
  */
 void setup_obarray(void) {
-    obarray = s_malloc(obarray_size * sizeof(String *));
-    obarray_end = obarray;
+    obarray = s_malloc(obarray_size * sizeof(Obarray_entry));
+    for (size_t i = 0; i < obarray_size; i++)
+        obarray[i].str = NULL;
+}
+
+/* -- hash_chars
+ * Computes the 32-bit FNV-1a hash of a string's characters.
+ */
+static uint32_t hash_chars(size_t len, char32_t *chars) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ chars[i]) * 16777619u;
+    return hash;
+}
+
+static int string_eq_buf(String *str, size_t len, char32_t *chars);
+static int string_eq_ascii(String *str, size_t len, const char *chars);
+
+/* -- find_entry
+ * Returns the entry of the table holding the given string,
+ * or the empty entry where it should be inserted.
+ */
+static Obarray_entry *find_entry(Obarray_entry *table, size_t size, size_t len, char32_t *chars, uint32_t hash) {
+    for (size_t i = hash & (size - 1); ; i = (i + 1) & (size - 1))
+        if (table[i].str == NULL || (table[i].hash == hash && string_eq_buf(table[i].str, len, chars)))
+            return &table[i];
+}
+
+/* -- obarray_find
+ * Finds the interned string with the given characters. Returns NULL if there is none.
+ */
+static String *obarray_find(size_t len, char32_t *chars, uint32_t hash) {
+    String *str = find_entry(obarray, obarray_size, len, chars, hash)->str;
+    if (str == NULL && old_obarray != NULL)
+        str = find_entry(old_obarray, old_obarray_size, len, chars, hash)->str;
+    return str;
+}
+
+/* -- migrate_obarray
+ * Moves up to `n` entries of the old table into the new one.
+ * Frees the old table once all entries have been moved.
+ */
+static void migrate_obarray(size_t n) {
+    for (; n > 0 && old_obarray_moved < old_obarray_size; n--, old_obarray_moved++) {
+        Obarray_entry entry = old_obarray[old_obarray_moved];
+        if (entry.str != NULL)
+            *find_entry(obarray, obarray_size, entry.str->len, entry.str->chars, entry.hash) = entry;
+    }
+    if (old_obarray_moved == old_obarray_size) {
+        free(old_obarray);
+        old_obarray = NULL;
+    }
+}
+
+/* -- obarray_insert
+ * Inserts a string not yet present in the obarray.
+ */
+static void obarray_insert(String *str, uint32_t hash) {
+    if (old_obarray != NULL)
+        migrate_obarray(OBARRAY_MIGRATION_STEP);
+    if (2 * (obarray_count + 1) > obarray_size) {
+        if (old_obarray != NULL)
+            migrate_obarray(SIZE_MAX);
+        old_obarray = obarray;
+        old_obarray_size = obarray_size;
+        old_obarray_moved = 0;
+        obarray_size *= 2;
+        obarray = s_malloc(obarray_size * sizeof(Obarray_entry));
+        for (size_t i = 0; i < obarray_size; i++)
+            obarray[i].str = NULL;
+    }
+    *find_entry(obarray, obarray_size, str->len, str->chars, hash) = (Obarray_entry){str, hash};
+    obarray_count++;
 }
 
 /* -- intern_string
@@ -26,60 +122,67 @@ void setup_obarray(void) {
  * Otherwise, the symbol string is added to the obarray and returned back.
  */
 String *intern_string(String *symbol) {
-    for (String **obarray_ptr = obarray; obarray_ptr < obarray_end; obarray_ptr++) {
-        if (string_eq(symbol, *obarray_ptr)) {
-            free(symbol);
-            return *obarray_ptr;
-        }
-    }
-    ptrdiff_t index = obarray_end - obarray;
-    if (index >= obarray_size) {
-        obarray_size *= 2;
-        obarray = s_realloc(obarray, obarray_size * sizeof(String *));
-        obarray_end = obarray + index;
+    uint32_t hash = hash_chars(symbol->len, symbol->chars);
+    String *interned = obarray_find(symbol->len, symbol->chars, hash);
+    if (interned != NULL) {
+        free(symbol);
+        return interned;
     }
-    *obarray_end++ = symbol;
+    obarray_insert(symbol, hash);
     return symbol;
 }
 
-static int string_eq_buf(String *str, size_t len, char32_t *chars);
-
 /* -- new_interned_string
  * Works like intern_string, except it takes the length and characters as separate arguments.
  * The string is not freed if it already exists in the obarray, and is copied otherwise.
  */
 String *new_interned_string(size_t len, char32_t *chars) {
-    for (String **obarray_ptr = obarray; obarray_ptr < obarray_end; obarray_ptr++) {
-        if (string_eq_buf(*obarray_ptr, len, chars))
-            return *obarray_ptr;
-    }
-    ptrdiff_t index = obarray_end - obarray;
-    if (index >= obarray_size) {
-        obarray_size *= 2;
-        obarray = s_realloc(obarray, obarray_size * sizeof(String *));
-        obarray_end = obarray + index;
-    }
-    String *interned = s_malloc(sizeof(String) + len * sizeof(char32_t));
+    uint32_t hash = hash_chars(len, chars);
+    String *interned = obarray_find(len, chars, hash);
+    if (interned != NULL)
+        return interned;
+    interned = s_malloc(sizeof(String) + len * sizeof(char32_t));
     interned->len = len;
     memcpy(interned->chars, chars, len * sizeof(char32_t));
-    *obarray_end++ = interned;
+    obarray_insert(interned, hash);
     return interned;
 }
 
 String *gc_alloc_string(size_t len) {
-    String *str = gc_alloc(sizeof(String) + (len ? len : 1) * sizeof(char32_t));
+    String *str = gc_alloc(TYPE_STRING, sizeof(String) + (len ? len : 1) * sizeof(char32_t));
     str->len = len;
     str->chars[0] = 0;
     return str;
 }
 
-String *new_interned_string_from_cstring(char *s) {
-    size_t len = strlen(s);
-    String *str = s_malloc(sizeof(String) + len * sizeof(char32_t));
-    str->len = len;
+/* -- new_interned_string_from_ascii
+ * Works like new_interned_string, but takes the characters as ASCII bytes,
+ * which are only copied if the string isn't in the obarray yet.
+ * The hash of ASCII characters is the same as that of their bytes.
+ */
+String *new_interned_string_from_ascii(size_t len, const char *chars) {
+    uint32_t hash = 2166136261u;
     for (size_t i = 0; i < len; i++)
-        str->chars[i] = (char32_t)s[i];
-    return intern_string(str);
+        hash = (hash ^ (unsigned char)chars[i]) * 16777619u;
+    for (int k = 0; k < 2; k++) {
+        Obarray_entry *table = k == 0 ? obarray : old_obarray;
+        size_t size = k == 0 ? obarray_size : old_obarray_size;
+        if (table == NULL)
+            continue;
+        for (size_t i = hash & (size - 1); table[i].str != NULL; i = (i + 1) & (size - 1))
+            if (table[i].hash == hash && string_eq_ascii(table[i].str, len, chars))
+                return table[i].str;
+    }
+    String *interned = s_malloc(sizeof(String) + len * sizeof(char32_t));
+    interned->len = len;
+    for (size_t i = 0; i < len; i++)
+        interned->chars[i] = (unsigned char)chars[i];
+    obarray_insert(interned, hash);
+    return interned;
+}
+
+String *new_interned_string_from_cstring(char *s) {
+    return new_interned_string_from_ascii(strlen(s), s);
 }
 
 int string_eq(String *str1, String *str2) {
@@ -99,3 +202,12 @@ static int string_eq_buf(String *str, size_t len, char32_t *chars) {
             return 0;
     return 1;
 }
+
+static int string_eq_ascii(String *str, size_t len, const char *chars) {
+    if (str->len != len)
+        return 0;
+    for (size_t i = 0; i < len; i++)
+        if (str->chars[i] != (unsigned char)chars[i])
+            return 0;
+    return 1;
+}
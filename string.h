@@ -4,5 +4,6 @@ void setup_obarray(void);
 String *intern_string(String *str);
 String *new_interned_string(size_t len, char32_t *chars);
 String *gc_alloc_string(size_t len);
+String *new_interned_string_from_ascii(size_t len, const char *chars);
 String *new_interned_string_from_cstring(char *s);
 int string_eq(String *str1, String *str2);
@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Runs scripts through the compilation cache twice, checking that they print
+# the same both times: once compiling them and filling the cache, and once
+# loading them from it. Uses the `scheme` binary built by compile.sh.
+
+set -e
+
+cd "$(dirname "$0")/.."
+dir="$(mktemp -d)"
+trap 'rm -rf "$dir"' EXIT
+export XDG_CACHE_HOME="$dir"
+
+check() {
+    printf '%s\n' "$1" > "$dir/test.scm"
+    for run in compiled cached; do
+        output="$(./scheme "$dir/test.scm")"
+        if [ "$output" != "$2" ]; then
+            echo "FAIL ($run): $1"
+            echo "  expected: $2"
+            echo "  got: $output"
+            exit 1
+        fi
+    done
+}
+
+check "(display '(1 \"a\" b 2.5))" '(1 a b 2.5)'
+# vector constants can't be saved as bytecode, so the file is never cached
+check "(display '#(1 2))" '#(1 2)'
+check "(display (vector-ref '#(a b) 1))" 'b'
+echo "ok"
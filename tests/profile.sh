@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# Runs programs with --profile, checking that they exit normally and that
+# the lambda they spend their time in is in the profile. Uses the `scheme`
+# binary built by compile.sh.
+
+set -e
+
+cd "$(dirname "$0")/.."
+dir="$(mktemp -d)"
+trap 'rm -rf "$dir"' EXIT
+
+check() {
+    printf '%s\n' "$1" > "$dir/test.scm"
+    if ! ./scheme "$dir/test.scm" --profile "$dir/profile" > /dev/null; then
+        echo "FAIL (exit): $1"
+        exit 1
+    fi
+    if ! grep -q "^$2" "$dir/profile"; then
+        echo "FAIL (profile): $1"
+        cat "$dir/profile"
+        exit 1
+    fi
+}
+
+# a top-level tail call leaves no caller on the stack
+check '(define (f i) (if (< i 3000000) (f (+ i 1)))) (f 0)' 'f lambda'
+check '(define (f i) (if (< i 3000000) (f (+ i 1)))) (display (f 0))' 'top level'
+echo "ok"
@@ -61,10 +61,26 @@ typedef enum Print_control {
  * The following values are used only for returning from functions:
  * - Environment - TYPE_ENV / env_data
  * - Instruction pointer - TYPE_INST / inst_data
+ * - Instruction pointer and size of a frame on the stack (see Env)
+ *   - TYPE_FRAME_INST / inst_data, frame_size
  * - Global environment - TYPE_GLOBAL_ENV / global_env_data
  * TYPE_PRINT_CONTROL is used only within functions used to print variables.
+ * TYPE_HEADER never appears in a value. It marks the header of an object
+ * in garbage-collected memory.
+ *
+ * By default, the data is aligned to 8 bytes, which leaves 4 bytes of padding
+ * after `type` and makes a Val take up 16 bytes. If COMPACT_VAL is defined,
+ * the padding is removed and a Val takes up 12 bytes, at the cost of unaligned
+ * access to the data. This shrinks stack slots, environments, and vectors by
+ * a quarter, and pairs from 32 to 24 bytes.
  */
 
+#ifdef COMPACT_VAL
+#define VAL_LAYOUT __attribute__((packed, aligned(4)))
+#else
+#define VAL_LAYOUT
+#endif
+
 typedef enum Type {
     TYPE_INT,
     TYPE_FLOAT,
@@ -87,11 +103,13 @@ typedef enum Type {
     TYPE_BROKEN_HEART,
     TYPE_ENV,
     TYPE_INST,
+    TYPE_FRAME_INST,
     TYPE_GLOBAL_ENV,
     TYPE_PRINT_CONTROL,
+    TYPE_HEADER,
 } Type;
 
-typedef struct Val {
+typedef struct VAL_LAYOUT Val {
     enum Type type;
     union {
         long long int_data;
@@ -105,7 +123,10 @@ typedef struct Val {
         struct Vector *vector_data;
         struct Env *env_data;
         struct Global_env *global_env_data;
-        uint32_t inst_data;
+        struct {
+            uint32_t inst_data;
+            uint32_t frame_size;
+        };
         enum Print_control print_control_data;
     };
 } Val;
@@ -154,12 +175,15 @@ typedef struct Vector {
  * Represents a lambda with the following elements:
  * - `params` is the number of parameters. If the highest bit is set, the function
  *   is variadic, with the remaining bits indicating the minimal number of arguments.
+ *   If PARAMS_STACK_FRAME is set, no lambda is created in the body of the function,
+ *   so its frame can't be captured and is kept on the stack (see Env).
  * - `body` contains the body of the lambda in the form of an instruction address.
  * - `env` contains the environment in which the lambda is to be executed.
  * `new_ptr` is used only for garbage collection and is normally unused.
  */
 
 #define PARAMS_VARIADIC 0x80000000
+#define PARAMS_STACK_FRAME 0x40000000u
 
 typedef struct Lambda {
     uint32_t params;
@@ -175,24 +199,48 @@ typedef struct Binding {
     String *var;
 } Binding;
 
+/* -- Global_env
+ * Represents a global environment with the following elements:
+ * - `bindings` contains `size` bindings in the order they were defined in,
+ *   with room for `capacity` bindings. The index of a binding never changes,
+ *   since it is stored in INST_VAR and INST_SET instructions.
+ * - `index` is an open-addressing hash table with `index_capacity` entries,
+ *   which maps interned names to the indices of their bindings.
+ *   Empty entries are set to UINT32_MAX.
+ */
+
 typedef struct Global_env {
     uint32_t size;
     uint32_t capacity;
     struct Binding *bindings;
+    uint32_t index_capacity;
+    uint32_t *index;
 } Global_env;
 
 /* -- Env
  * Represents an environment with the following elements:
- * - `outer` contains the outer environment.
  * - `size` contains the number of values in `vals`;
+ * - `outer` contains the outer environment.
  * - `vals` contains the values bound in the lowest frame.
  * Environments are represented with pointers to `Env`s,
  * where NULL is used to represent the global environment.
+ *
+ * The frame of a lambda with PARAMS_STACK_FRAME is not allocated, but kept
+ * on the stack where the lambda and its arguments were pushed by the call.
+ * The slot of the lambda is replaced with a TYPE_ENV value pointing to
+ * the outer environment, and the fields of `Env` are laid out like those
+ * of a Val, so the slot can be used as the header of the frame.
+ * `size` then holds TYPE_ENV instead of the size, which is only needed
+ * by the garbage collector, and it finds the outer environment as part
+ * of the stack. The frame is followed by the environment and a TYPE_FRAME_INST
+ * instruction pointer to return to, which holds the size of the frame:
+ *   lambda env | arg 1 | ... | arg n | caller env | return address, n
+ * Returning from the lambda or calling another in tail position removes it.
  */
 
-typedef struct Env {
-    struct Env *outer;
+typedef struct VAL_LAYOUT Env {
     uint32_t size;
+    struct Env *outer;
     struct Val vals[];
 } Env;
 
@@ -221,18 +269,23 @@ typedef struct High_prim_return {
 
 /* -- inst
  * Represents a bytecode instruction.
+ * Instructions contain no pointers or values, only 32-bit operands, which keeps
+ * each of them at 12 bytes. Constant values and names are instead stored
+ * in the constant pool `consts` and referred to by their index in it.
  * The following are valid instructions:
- * - INST_CONST / val - Pushes a constant value onto the stack.
+ * - INST_CONST / index - Pushes the constant at `index` onto the stack.
  * - INST_VAR / var - Finds a variable at the given location
  *   in the current environment and pushes it onto the stack.
- * - INST_NAME / name - Locates a name in the global environment
- *   and changes to a INST_VAR instruction without moving the program counter.
- * - INST_DEF / name - Pops a value off the stack and binds it to `name`
- *   in the global environment.
+ * - INST_NAME / index - Locates the name (a symbol constant at `index`)
+ *   in the global environment and changes to a INST_VAR instruction
+ *   without moving the program counter.
+ * - INST_DEF / index - Pops a value off the stack and binds it to the name
+ *   at `index` in the global environment.
  * - INST_SET / var - Pops a value off the stack and assigns it
  *   to the variable located at `var` in the current environment.
- * - INST_SET_NAME / name - Locates a name in the global environment
- *   and changes to a INST_SET instruction without moving the program counter.
+ * - INST_SET_NAME / index - Locates the name at `index` in the global
+ *   environment and changes to a INST_SET instruction without moving
+ *   the program counter.
  * - INST_JUMP / index - Jumps to the instruction at given index.
  * - INST_JUMP_FALSE / index - Pops a value off the stack and jumps to
  *   the given index if it's false.
@@ -255,19 +308,48 @@ typedef struct High_prim_return {
  *   Does nothing when executed.
  * - INST_EOF / -unspecified- - Inserted at the end of code when it is loaded
  *   from a bytecode file.
+ * - INST_ADD, INST_SUB, INST_LT, INST_NUM_EQ / num - Pop two numbers off
+ *   the stack and push the result of applying +, -, < or = to them.
+ *   The compiler emits them for calls of these globals with two arguments.
+ *   If the global has been redefined, they push its value below
+ *   the arguments and are executed as INST_CALL instead, so `num` is always 2.
+ * The following specialized instructions are never emitted by the compiler,
+ * but replace INST_VAR and INST_SET instructions with the same operand
+ * when their location is in the current frame, the frame enclosing it,
+ * or the global environment, saving the walk up the environment
+ * (see specialize_insts):
+ * - INST_VAR_0 / var, INST_VAR_1 / var, INST_GLOBAL / var
+ * - INST_SET_0 / var, INST_SET_1 / var, INST_SET_GLOBAL / var
+ * Likewise, the following superinstructions replace the first of two
+ * instructions when fusing them. They keep the operand of the replaced
+ * instruction and read the operand of the second one, which is left
+ * unchanged, so jumps to it stay valid:
+ * - INST_VAR_CALL / var - INST_VAR followed by INST_CALL.
+ * - INST_CALL_GLOBAL / var - INST_VAR of a global variable followed by INST_CALL.
+ * - INST_VAR_JUMP_FALSE / var - INST_VAR followed by INST_JUMP_FALSE.
+ * - INST_CONST_CALL / index - INST_CONST followed by INST_CALL.
+ * - INST_CONST_RETURN / index - INST_CONST followed by INST_RETURN.
+ * INST_JIT / index is never emitted by the compiler either. It follows
+ * a call instruction made by machine code compiled by the JIT compiler,
+ * and resumes the machine code after the call returns (see jit.c).
+ * INST_LAZY / index fills the body of a lambda from a bytecode file which
+ * hasn't been loaded yet. Executing it loads the body of lambda `index`
+ * in place of it (see load_lazy_lambda).
  */
 
 enum Inst_type {INST_CONST, INST_VAR, INST_NAME, INST_DEF,
     INST_SET, INST_SET_NAME, INST_JUMP, INST_JUMP_FALSE, INST_LAMBDA,
     INST_CALL, INST_TAIL_CALL, INST_RETURN, INST_DELETE, INST_CONS,
-    INST_EXPR, INST_EOF};
+    INST_EXPR, INST_EOF, INST_ADD, INST_SUB, INST_LT, INST_NUM_EQ, INST_VAR_0, INST_VAR_1, INST_GLOBAL,
+    INST_SET_0, INST_SET_1, INST_SET_GLOBAL, INST_VAR_CALL, INST_CALL_GLOBAL,
+    INST_VAR_JUMP_FALSE, INST_CONST_CALL, INST_CONST_RETURN, INST_JIT, INST_LAZY};
+
+#define INST_TYPES_NUM (INST_LAZY + 1)
 
 typedef struct Inst {
     enum Inst_type type;
     union {
-        Val val;
         struct Env_loc var;
-        String *name;
         uint32_t index;
         uint32_t num;
         struct {
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vm_stats.h"
+#include "types.h"
+#include "display.h"
+
+#define VM_STATS_TOP_PAIRS 20
+
+static enum Inst_type last_inst = INST_EXPR;
+
+void count_inst(enum Inst_type type) {
+    vm_stats.insts[type]++;
+    vm_stats.inst_pairs[last_inst][type]++;
+    last_inst = type;
+}
+
+void count_frame_depth(uint32_t frame) {
+    if (frame == UINT32_MAX)
+        vm_stats.global_accesses++;
+    else
+        vm_stats.frame_depths[frame < VM_FRAME_DEPTHS ? frame : VM_FRAME_DEPTHS - 1]++;
+}
+
+static double percent(uint64_t n, uint64_t total) {
+    return total ? 100.0 * (double)n / (double)total : 0.0;
+}
+
+void print_vm_stats(void) {
+    fflush(stdout);
+    uint64_t total = 0;
+    for (int i = 0; i < INST_TYPES_NUM; i++)
+        total += vm_stats.insts[i];
+    eprintf("VM statistics:\n");
+    eprintf("  instructions executed: %"PRIu64"\n", total);
+    for (int i = 0; i < INST_TYPES_NUM; i++)
+        if (vm_stats.insts[i] != 0)
+            eprintf("    %-14s %14"PRIu64" %6.2f%%\n", inst_name((enum Inst_type)i),
+                    vm_stats.insts[i], percent(vm_stats.insts[i], total));
+
+    // the most frequent pairs are found by repeatedly taking the largest remaining one
+    static int printed[INST_TYPES_NUM][INST_TYPES_NUM];
+    eprintf("  most frequent instruction pairs:\n");
+    for (int n = 0; n < VM_STATS_TOP_PAIRS; n++) {
+        int best_i = -1, best_j = -1;
+        for (int i = 0; i < INST_TYPES_NUM; i++)
+            for (int j = 0; j < INST_TYPES_NUM; j++)
+                if (!printed[i][j] && vm_stats.inst_pairs[i][j] != 0
+                        && (best_i == -1 || vm_stats.inst_pairs[i][j] > vm_stats.inst_pairs[best_i][best_j])) {
+                    best_i = i;
+                    best_j = j;
+                }
+        if (best_i == -1)
+            break;
+        printed[best_i][best_j] = 1;
+        eprintf("    %-14s %-14s %14"PRIu64" %6.2f%%\n", inst_name((enum Inst_type)best_i),
+                inst_name((enum Inst_type)best_j), vm_stats.inst_pairs[best_i][best_j],
+                percent(vm_stats.inst_pairs[best_i][best_j], total));
+    }
+
+    uint64_t calls = vm_stats.prim_calls + vm_stats.lambda_calls + vm_stats.high_prim_calls;
+    eprintf("  calls: %"PRIu64"\n", calls);
+    eprintf("    primitive      %14"PRIu64" %6.2f%%\n", vm_stats.prim_calls, percent(vm_stats.prim_calls, calls));
+    eprintf("    lambda         %14"PRIu64" %6.2f%%\n", vm_stats.lambda_calls, percent(vm_stats.lambda_calls, calls));
+    eprintf("    high primitive %14"PRIu64" %6.2f%%\n", vm_stats.high_prim_calls, percent(vm_stats.high_prim_calls, calls));
+    eprintf("  variadic argument conses: %"PRIu64"\n", vm_stats.variadic_conses);
+    eprintf("  stack frames: %"PRIu64" %6.2f%% of lambda calls\n", vm_stats.stack_frames,
+            percent(vm_stats.stack_frames, vm_stats.lambda_calls));
+
+    uint64_t accesses = vm_stats.global_accesses;
+    for (int i = 0; i < VM_FRAME_DEPTHS; i++)
+        accesses += vm_stats.frame_depths[i];
+    eprintf("  variable accesses by frame depth: %"PRIu64"\n", accesses);
+    for (int i = 0; i < VM_FRAME_DEPTHS; i++) {
+        char label[8];
+        snprintf(label, sizeof(label), "%d%s", i, i == VM_FRAME_DEPTHS - 1 ? "+" : "");
+        eprintf("    %-14s %14"PRIu64" %6.2f%%\n", label,
+                vm_stats.frame_depths[i], percent(vm_stats.frame_depths[i], accesses));
+    }
+    eprintf("    %-14s %14"PRIu64" %6.2f%%\n", "global",
+            vm_stats.global_accesses, percent(vm_stats.global_accesses, accesses));
+}
@@ -0,0 +1,47 @@
+#include "types.h"
+
+/* == vm_stats.h
+ * The virtual machine statistics are only collected if VM_STATS is defined.
+ * VM_STAT(stmt) expands to `stmt` only in that case, and is used to update
+ * the statistics in the interpreter without slowing down regular builds.
+ */
+
+#ifdef VM_STATS
+#define VM_STAT(stmt) stmt
+#else
+#define VM_STAT(stmt)
+#endif
+
+/* -- VM_stats
+ * - `insts` contains the number of executions of each instruction type,
+ *   and `inst_pairs` of each instruction type followed by another.
+ * - `prim_calls`, `lambda_calls`, and `high_prim_calls` contain the number
+ *   of calls of each kind of procedure, including tail calls.
+ * - `variadic_conses` is the number of pairs allocated to pass arguments
+ *   to variadic lambdas.
+ * - `stack_frames` is the number of lambda calls whose frame was kept
+ *   on the stack instead of allocating an environment.
+ * - `frame_depths` contains the number of variable accesses by the number
+ *   of frames walked to find the variable, with the last entry counting
+ *   accesses of at least VM_FRAME_DEPTHS - 1 frames.
+ *   `global_accesses` contains the number of accesses to global variables.
+ */
+
+#define VM_FRAME_DEPTHS 8
+
+typedef struct VM_stats {
+    uint64_t insts[INST_TYPES_NUM];
+    uint64_t inst_pairs[INST_TYPES_NUM][INST_TYPES_NUM];
+    uint64_t prim_calls;
+    uint64_t lambda_calls;
+    uint64_t high_prim_calls;
+    uint64_t variadic_conses;
+    uint64_t stack_frames;
+    uint64_t frame_depths[VM_FRAME_DEPTHS];
+    uint64_t global_accesses;
+} VM_stats;
+
+VM_stats vm_stats;
+void count_inst(enum Inst_type type);
+void count_frame_depth(uint32_t frame);
+void print_vm_stats(void);